@@ -0,0 +1,308 @@
+#include "kernel/yosys.h"
+
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+USING_YOSYS_NAMESPACE
+PRIVATE_NAMESPACE_BEGIN
+
+struct BenchOptions {
+  std::vector<size_t> sizes_    {1000, 10000, 100000, 1000000, 10000000};
+  size_t              modules_  {1};
+  int                 width_    {8};
+  int                 depth_    {1};
+  bool                skewed_   {true};
+  unsigned            seed_     {1};
+  std::string         args_     {};
+};
+
+//Synthetic design generator.
+//Leaf modules hold the cells: BENCH_GATE cells with width_ bit bus ports,
+//whose inputs are picked among the already created buses (uniformly,
+//or skewed towards the first ones to create high fanout nets), and one
+//BENCH_DFF every four gates, all sharing the clock.
+//Each leaf is wrapped in depth_-1 hierarchy levels and the top chains
+//the outermost wrappers.
+class BenchDesign {
+  public:
+    BenchDesign(const BenchOptions& options, size_t cells):
+      options_(options), cells_(cells), random_(options.seed_) {}
+
+    RTLIL::Design* create() {
+      auto design = new RTLIL::Design;
+      createPrimitives(design);
+      size_t cellsPerModule = std::max<size_t>(1, cells_ / options_.modules_);
+      std::vector<RTLIL::Module*> children;
+      for (size_t i = 0; i < options_.modules_; ++i) {
+        auto module = createLeaf(design, stringf("\\bench_leaf_%zu", i), cellsPerModule);
+        for (int level = 1; level < options_.depth_; ++level) {
+          auto wrapper = createModule(design, stringf("\\bench_wrap%d_%zu", level, i));
+          instantiate(wrapper, module, stringf("\\u_%zu", i),
+            wrapper->wire(ID(in)), wrapper->wire(ID(out)));
+          module = wrapper;
+        }
+        children.push_back(module);
+      }
+      auto top = createModule(design, "\\bench_top");
+      top->set_bool_attribute(ID::top);
+      RTLIL::SigSpec in = top->wire(ID(in));
+      for (size_t i = 0; i < children.size(); ++i) {
+        RTLIL::SigSpec out = (i+1 == children.size())
+          ? RTLIL::SigSpec(top->wire(ID(out)))
+          : RTLIL::SigSpec(top->addWire(stringf("\\chain_%zu", i), options_.width_));
+        instantiate(top, children[i], stringf("\\u_%zu", i), in, out);
+        in = out;
+      }
+      return design;
+    }
+
+  private:
+    void createPrimitives(RTLIL::Design* design) {
+      auto gate = design->addModule(ID(BENCH_GATE));
+      gate->set_bool_attribute(ID::blackbox);
+      gate->addWire(ID(A), options_.width_)->port_input = true;
+      gate->addWire(ID(B), options_.width_)->port_input = true;
+      gate->addWire(ID(Y), options_.width_)->port_output = true;
+      gate->fixup_ports();
+      auto dff = design->addModule(ID(BENCH_DFF));
+      dff->set_bool_attribute(ID::blackbox);
+      dff->addWire(ID(C))->port_input = true;
+      dff->addWire(ID(D))->port_input = true;
+      dff->addWire(ID(Q))->port_output = true;
+      dff->fixup_ports();
+    }
+
+    RTLIL::Module* createModule(RTLIL::Design* design, const std::string& name) {
+      auto module = design->addModule(name);
+      module->addWire(ID(clk))->port_input = true;
+      module->addWire(ID(in), options_.width_)->port_input = true;
+      module->addWire(ID(out), options_.width_)->port_output = true;
+      module->fixup_ports();
+      return module;
+    }
+
+    void instantiate(
+      RTLIL::Module* parent, RTLIL::Module* child, const std::string& name,
+      const RTLIL::SigSpec& in, const RTLIL::SigSpec& out) {
+      auto cell = parent->addCell(name, child->name);
+      cell->setPort(ID(clk), parent->wire(ID(clk)));
+      cell->setPort(ID(in), in);
+      cell->setPort(ID(out), out);
+    }
+
+    RTLIL::Wire* pick(const std::vector<RTLIL::Wire*>& buses) {
+      double u = std::uniform_real_distribution<double>(0, 1)(random_);
+      if (options_.skewed_) {
+        u = u*u*u*u;
+      }
+      return buses[std::min(buses.size() - 1, size_t(u * buses.size()))];
+    }
+
+    RTLIL::Module* createLeaf(RTLIL::Design* design, const std::string& name, size_t cells) {
+      auto module = createModule(design, name);
+      auto width = options_.width_;
+      std::vector<RTLIL::Wire*> buses {module->wire(ID(in))};
+      buses.reserve(cells + 1);
+      auto clk = module->wire(ID(clk));
+      for (size_t i = 0; i < cells; ++i) {
+        if (i % 5 == 4) {
+          auto dff = module->addCell(stringf("\\ff_%zu", i), ID(BENCH_DFF));
+          auto q = module->addWire(stringf("\\q_%zu", i));
+          dff->setPort(ID(C), clk);
+          dff->setPort(ID(D), RTLIL::SigBit(pick(buses), 0));
+          dff->setPort(ID(Q), q);
+          continue;
+        }
+        auto gate = module->addCell(stringf("$gate$%zu", i), ID(BENCH_GATE));
+        auto y = module->addWire(stringf("$n$%zu", i), width);
+        gate->setPort(ID(A), pick(buses));
+        //B mixes two buses so that connections span several chunks
+        RTLIL::SigSpec b(pick(buses), 0, width/2);
+        b.append(RTLIL::SigSpec(pick(buses), width/2, width - width/2));
+        gate->setPort(ID(B), b);
+        gate->setPort(ID(Y), y);
+        buses.push_back(y);
+      }
+      module->connect(module->wire(ID(out)), buses.back());
+      return module;
+    }
+
+    const BenchOptions& options_;
+    size_t              cells_;
+    std::mt19937_64     random_;
+};
+
+//Returns the "<key>": <number> entries of a section of an snl_stats.json
+//text, or its top level numbers for an empty section.
+//Errors out when the section is missing.
+dict<std::string, double> readStats(const std::string& json, const std::string& section) {
+  dict<std::string, double> values;
+  bool found = section.empty();
+  bool inSection = section.empty();
+  int depth = 0;
+  std::string key;
+  for (size_t i = 0; i < json.size(); ++i) {
+    switch (json[i]) {
+      case '"':
+        key.clear();
+        for (++i; i < json.size() and json[i] != '"'; ++i) {
+          //escaped characters are kept as they are
+          if (json[i] == '\\') {
+            ++i;
+          }
+          key += json[i];
+        }
+        break;
+      case '{':
+        ++depth;
+        if (depth == 2 and key == section) {
+          found = inSection = true;
+        }
+        break;
+      case '}':
+        if (depth-- == 2) {
+          inSection = section.empty();
+        }
+        break;
+      case ':': {
+        auto value = json.find_first_not_of(" \n", i+1);
+        bool number = value != std::string::npos and json[value] != '{';
+        if (number and inSection and depth == (section.empty() ? 1 : 2)) {
+          values[key] = atof(json.c_str() + value);
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  if (not found) {
+    log_error("No \"%s\" section in the write_naja-if statistics.\n", section.c_str());
+  }
+  return values;
+}
+
+struct SNLBenchPass: public Pass {
+  SNLBenchPass() : Pass("snl_bench", "benchmark write_naja-if on synthetic designs") {}
+
+  void help() override
+  {
+    log("\n");
+    log("    snl_bench [options]\n");
+    log("\n");
+    log("Build synthetic designs and time write_naja-if on them, reporting the\n");
+    log("time of each export phase, throughput and memory.\n");
+    log("Requires the naja-if plugin (yosys -m naja-if -m naja-if-bench).\n");
+    log("\n");
+    log("    -cells <N>[,<N>...]\n");
+    log("        total cells of each generated design\n");
+    log("        (default: 1000,10000,100000,1000000,10000000).\n");
+    log("\n");
+    log("    -modules <N>\n");
+    log("        leaf modules sharing the cells (default: 1).\n");
+    log("\n");
+    log("    -width <N>\n");
+    log("        bus width of the gate ports (default: 8).\n");
+    log("\n");
+    log("    -depth <N>\n");
+    log("        hierarchy depth above the leaf modules (default: 1).\n");
+    log("\n");
+    log("    -fanout <uniform|skewed>\n");
+    log("        distribution of gate inputs over the existing nets. skewed\n");
+    log("        creates a few very high fanout nets (default: skewed).\n");
+    log("\n");
+    log("    -seed <N>\n");
+    log("        random seed (default: 1).\n");
+    log("\n");
+    log("    -args <string>\n");
+    log("        extra write_naja-if options, for instance \"-j 8\".\n");
+    log("\n");
+  }
+
+  void execute(std::vector<std::string> args, RTLIL::Design* yosysDesign) override {
+    log_header(yosysDesign, "Executing SNL backend benchmark.\n");
+    BenchOptions options;
+    size_t argidx;
+    for (argidx = 1; argidx < args.size(); argidx++) {
+      if (args[argidx] == "-cells" && argidx+1 < args.size()) {
+        options.sizes_.clear();
+        for (auto& size: split_tokens(args[++argidx], ",")) {
+          options.sizes_.push_back(std::stoull(size));
+        }
+        continue;
+      }
+      if (args[argidx] == "-modules" && argidx+1 < args.size()) {
+        options.modules_ = std::max(1, atoi(args[++argidx].c_str()));
+        continue;
+      }
+      if (args[argidx] == "-width" && argidx+1 < args.size()) {
+        options.width_ = std::max(2, atoi(args[++argidx].c_str()));
+        continue;
+      }
+      if (args[argidx] == "-depth" && argidx+1 < args.size()) {
+        options.depth_ = std::max(1, atoi(args[++argidx].c_str()));
+        continue;
+      }
+      if (args[argidx] == "-fanout" && argidx+1 < args.size()) {
+        options.skewed_ = args[++argidx] == "skewed";
+        continue;
+      }
+      if (args[argidx] == "-seed" && argidx+1 < args.size()) {
+        options.seed_ = atoi(args[++argidx].c_str());
+        continue;
+      }
+      if (args[argidx] == "-args" && argidx+1 < args.size()) {
+        options.args_ = args[++argidx];
+        continue;
+      }
+      break;
+    }
+    if (argidx < args.size()) {
+      cmd_error(args, argidx, "Unknown option or extra argument.");
+    }
+
+    log("%12s %8s %10s %10s %10s %10s %12s %10s %10s %10s\n",
+      "cells", "modules", "create(s)", "intf(s)", "impl(s)", "total(s)",
+      "cells/s", "MB", "MB/s", "RSS(MB)");
+    for (auto size: options.sizes_) {
+      using Clock = std::chrono::steady_clock;
+      auto start = Clock::now();
+      std::unique_ptr<RTLIL::Design> design(BenchDesign(options, size).create());
+      auto created = Clock::now();
+      Pass::call(design.get(), "write_naja-if -stats " + options.args_);
+      auto written = Clock::now();
+
+      //the statistics are next to the export, wherever -args puts it
+      auto statsPath = design->scratchpad_get_string("write_naja-if.stats");
+      if (statsPath.empty()) {
+        log_error("write_naja-if did not write its statistics.\n");
+      }
+      std::ifstream statsStream(statsPath);
+      if (not statsStream) {
+        log_error("Cannot read %s.\n", statsPath.c_str());
+      }
+      std::stringstream json;
+      json << statsStream.rdbuf();
+      auto phases = readStats(json.str(), "phases_seconds");
+      auto files = readStats(json.str(), "file_bytes");
+      auto counters = readStats(json.str(), "counters");
+      double bytes = 0;
+      for (const auto& file: files) {
+        bytes += file.second;
+      }
+      double implementation = phases.at("implementation", 0) + phases.at("merge_implementation", 0);
+      double total = std::chrono::duration<double>(written - created).count();
+      double megaBytes = bytes / (1 << 20);
+      log("%12zu %8zu %10.3f %10.3f %10.3f %10.3f %12.0f %10.1f %10.1f %10.1f\n",
+        size, size_t(counters.at("modules", 0)),
+        std::chrono::duration<double>(created - start).count(),
+        phases.at("interface", 0), implementation, total,
+        counters.at("instances", 0) / total, megaBytes, megaBytes / total,
+        readStats(json.str(), "").at("peak_rss_bytes", 0) / (1 << 20));
+    }
+  }
+} SNLBenchPass;
+
+PRIVATE_NAMESPACE_END
@@ -0,0 +1,98 @@
+#include "snl_cache.h"
+
+#include <fcntl.h>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+capnp::ReaderOptions getReaderOptions() {
+  //fragments were written by the plugin itself and can be very large
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = std::numeric_limits<uint64_t>::max();
+  return options;
+}
+
+}
+
+SNLCache::Fragment::Fragment(std::vector<capnp::word>&& words):
+  words_(std::move(words)),
+  reader_(kj::arrayPtr(words_.data(), words_.size()), getReaderOptions())
+{}
+
+SNLCache::SNLCache(const std::filesystem::path& dir): dir_(dir) {
+  std::filesystem::create_directories(dir_);
+}
+
+std::filesystem::path SNLCache::getPath(const std::string& key, const std::string& kind) const {
+  return dir_/(key + "." + kind);
+}
+
+std::unique_ptr<SNLCache::Fragment> SNLCache::load(const std::string& key, const std::string& kind) const {
+  auto path = getPath(key, kind);
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  std::unique_ptr<Fragment> fragment;
+  auto size = lseek(fd, 0, SEEK_END);
+  if (size > 0 and size % sizeof(capnp::word) == 0
+    and lseek(fd, 0, SEEK_SET) == 0) {
+    std::vector<capnp::word> words(size / sizeof(capnp::word));
+    auto data = reinterpret_cast<char*>(words.data());
+    ssize_t position = 0;
+    while (position < size) {
+      auto count = read(fd, data + position, size - position);
+      if (count <= 0) {
+        break;
+      }
+      position += count;
+    }
+    if (position == size) {
+      try {
+        fragment = std::make_unique<Fragment>(std::move(words));
+      } catch (...) {
+        //malformed entry, rebuilt by the caller
+        fragment.reset();
+      }
+    }
+  }
+  close(fd);
+  return fragment;
+}
+
+bool SNLCache::store(const std::string& key, const std::string& kind, capnp::MessageBuilder& message) const {
+  auto path = getPath(key, kind);
+  std::ostringstream suffix;
+  suffix << "." << getpid() << "." << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+  auto temporaryPath = path;
+  temporaryPath += suffix.str();
+  int fd = open(
+    temporaryPath.c_str(),
+    O_CREAT | O_WRONLY | O_TRUNC,
+    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0) {
+    return false;
+  }
+  bool written = true;
+  try {
+    capnp::writeMessageToFd(fd, message);
+  } catch (...) {
+    written = false;
+  }
+  if (close(fd) != 0) {
+    written = false;
+  }
+  std::error_code error;
+  if (written) {
+    std::filesystem::rename(temporaryPath, path, error);
+  }
+  if (not written or error) {
+    std::filesystem::remove(temporaryPath, error);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,56 @@
+#ifndef __SNL_CACHE_H_
+#define __SNL_CACHE_H_
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef VOID
+#undef VOID
+#endif
+#include <capnp/message.h>
+#include <capnp/serialize.h>
+
+//On disk cache of export fragments (write_naja-if -cache).
+//Each fragment is one unpacked capnp message stored in
+//<dir>/<key>.<kind>, where key is a content hash of everything the
+//fragment was built from. Entries are written to a temporary file then
+//renamed, so concurrent writers and interrupted exports never leave
+//partial entries. Nothing is evicted: the directory can be removed at
+//any time.
+//load and store can be called concurrently.
+class SNLCache {
+  public:
+    //A cached message, kept in memory while its root is in use
+    class Fragment {
+      public:
+        Fragment(std::vector<capnp::word>&& words);
+        Fragment(const Fragment&) = delete;
+        Fragment& operator=(const Fragment&) = delete;
+        template<typename T>
+        typename T::Reader getRoot() {
+          return reader_.getRoot<T>();
+        }
+        size_t getSizeInWords() const {
+          return words_.size();
+        }
+      private:
+        std::vector<capnp::word>      words_;
+        capnp::FlatArrayMessageReader reader_;
+    };
+
+    SNLCache(const std::filesystem::path& dir);
+
+    //Returns nullptr if the entry does not exist or cannot be read
+    std::unique_ptr<Fragment> load(const std::string& key, const std::string& kind) const;
+    //Returns false if the entry could not be written
+    bool store(const std::string& key, const std::string& kind, capnp::MessageBuilder& message) const;
+
+  private:
+    std::filesystem::path getPath(const std::string& key, const std::string& kind) const;
+
+    std::filesystem::path dir_;
+};
+
+#endif /* __SNL_CACHE_H_ */
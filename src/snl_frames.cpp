@@ -0,0 +1,148 @@
+#include "snl_frames.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <zstd.h>
+
+#include "snl_parallel.h"
+#include "snl_writer.h"
+
+namespace {
+
+constexpr char Magic[4] = {'N', 'J', 'Z', 'F'};
+constexpr size_t HeaderSize = sizeof(Magic) + 3*sizeof(uint32_t) + 3*sizeof(uint64_t);
+//Largest decompressed to compressed size ratio of a zstd frame: a block
+//decodes to at most 128 KiB from 4 bytes (RLE block)
+constexpr size_t MaxRatio = 128*1024 / 4;
+
+template<typename T>
+void append(SNLFrames::Bytes& bytes, T value) {
+  auto p = reinterpret_cast<const uint8_t*>(&value);
+  bytes.insert(bytes.end(), p, p + sizeof(T));
+}
+
+template<typename T>
+T extract(const uint8_t* data, size_t size, size_t& position) {
+  if (position + sizeof(T) > size) {
+    throw std::runtime_error("truncated SNL frames header");
+  }
+  T value;
+  std::memcpy(&value, data + position, sizeof(T));
+  position += sizeof(T);
+  return value;
+}
+
+}
+
+bool SNLFrames::isFrames(const uint8_t* data, size_t size) {
+  return size >= sizeof(Magic) and std::memcmp(data, Magic, sizeof(Magic)) == 0;
+}
+
+void SNLFrames::write(
+  int fd,
+  const uint8_t* data, size_t size,
+  size_t frameSize, int level, unsigned jobs) {
+  auto bytes = compress(data, size, frameSize, level, jobs);
+  SNLWriter::writeAll(fd, bytes.data(), bytes.size());
+}
+
+SNLFrames::Bytes SNLFrames::compress(
+  const uint8_t* data, size_t size,
+  size_t frameSize, int level, unsigned jobs) {
+  size_t framesSize = (size + frameSize - 1) / frameSize;
+  std::vector<Bytes> frames(framesSize);
+  parallelFor(framesSize, jobs, [&](size_t i) {
+    size_t first = i * frameSize;
+    size_t rawSize = std::min(frameSize, size - first);
+    auto& frame = frames[i];
+    frame.resize(ZSTD_compressBound(rawSize));
+    auto compressedSize = ZSTD_compress(frame.data(), frame.size(), data + first, rawSize, level);
+    if (ZSTD_isError(compressedSize)) {
+      throw std::runtime_error(std::string("zstd compression error: ") + ZSTD_getErrorName(compressedSize));
+    }
+    frame.resize(compressedSize);
+  });
+
+  size_t compressedSize = 0;
+  for (const auto& frame: frames) {
+    compressedSize += frame.size();
+  }
+  Bytes header;
+  header.reserve(HeaderSize + framesSize*sizeof(uint64_t) + compressedSize);
+  header.insert(header.end(), Magic, Magic + sizeof(Magic));
+  append<uint32_t>(header, Version);
+  append<uint32_t>(header, static_cast<uint32_t>(Codec::ZSTD));
+  append<uint32_t>(header, 0);
+  append<uint64_t>(header, size);
+  append<uint64_t>(header, frameSize);
+  append<uint64_t>(header, framesSize);
+  for (const auto& frame: frames) {
+    append<uint64_t>(header, frame.size());
+  }
+  for (auto& frame: frames) {
+    header.insert(header.end(), frame.begin(), frame.end());
+    Bytes().swap(frame);
+  }
+  return header;
+}
+
+SNLFrames::Bytes SNLFrames::read(const uint8_t* data, size_t size, unsigned jobs) {
+  if (not isFrames(data, size)) {
+    throw std::runtime_error("not an SNL frames container");
+  }
+  size_t position = sizeof(Magic);
+  auto version = extract<uint32_t>(data, size, position);
+  auto codec = extract<uint32_t>(data, size, position);
+  extract<uint32_t>(data, size, position);
+  if (version != Version or codec != static_cast<uint32_t>(Codec::ZSTD)) {
+    throw std::runtime_error("unsupported SNL frames version or codec");
+  }
+  auto rawSize = extract<uint64_t>(data, size, position);
+  auto frameSize = extract<uint64_t>(data, size, position);
+  auto framesSize = extract<uint64_t>(data, size, position);
+  //sizes are checked against the data before anything is allocated
+  if (framesSize > (size - position) / sizeof(uint64_t)) {
+    throw std::runtime_error("truncated SNL frames header");
+  }
+  //rawSize fits in the frames: rawSize <= framesSize*frameSize
+  if (frameSize == 0 or framesSize != rawSize / frameSize + (rawSize % frameSize != 0)) {
+    throw std::runtime_error("inconsistent SNL frames header");
+  }
+  //offset of each compressed frame
+  std::vector<size_t> offsets(framesSize + 1);
+  offsets[0] = position + framesSize*sizeof(uint64_t);
+  for (size_t i = 0; i < framesSize; ++i) {
+    auto compressedSize = extract<uint64_t>(data, size, position);
+    if (compressedSize > size - offsets[i]) {
+      throw std::runtime_error("truncated SNL frames");
+    }
+    offsets[i+1] = offsets[i] + compressedSize;
+  }
+  //each frame records its own size, which must match the header, and
+  //rawSize is capped by the compressed sizes before it is allocated
+  for (size_t i = 0; i < framesSize; ++i) {
+    size_t frameRawSize = std::min<size_t>(frameSize, rawSize - i*frameSize);
+    if (frameRawSize / MaxRatio > offsets[i+1] - offsets[i]) {
+      throw std::runtime_error("inconsistent SNL frame " + std::to_string(i));
+    }
+    auto contentSize = ZSTD_getFrameContentSize(data + offsets[i], offsets[i+1] - offsets[i]);
+    if (contentSize != frameRawSize) {
+      throw std::runtime_error("inconsistent SNL frame " + std::to_string(i));
+    }
+  }
+  Bytes bytes(rawSize);
+  parallelFor(framesSize, jobs, [&](size_t i) {
+    size_t first = i * frameSize;
+    size_t frameRawSize = std::min<size_t>(frameSize, rawSize - first);
+    auto decompressedSize = ZSTD_decompress(
+      bytes.data() + first, frameRawSize,
+      data + offsets[i], offsets[i+1] - offsets[i]);
+    if (ZSTD_isError(decompressedSize) or decompressedSize != frameRawSize) {
+      throw std::runtime_error("zstd decompression error in SNL frame " + std::to_string(i));
+    }
+  });
+  return bytes;
+}
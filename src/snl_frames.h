@@ -0,0 +1,42 @@
+#ifndef __SNL_FRAMES_H_
+#define __SNL_FRAMES_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//Compressed frame container used for snl/*.snl files when compression
+//is enabled (see snl.mf "C" line).
+//Data is cut in frames of frameSize bytes that are compressed
+//independently, so both compression and decompression run in parallel.
+//
+//Layout (little endian):
+//  magic "NJZF"
+//  uint32 version, uint32 codec, uint32 reserved
+//  uint64 uncompressed size, uint64 frame size, uint64 frames count
+//  uint64 compressed size of each frame
+//  compressed frames
+class SNLFrames {
+  public:
+    enum class Codec: uint32_t { ZSTD = 1 };
+    static constexpr uint32_t Version = 1;
+    static constexpr size_t DefaultFrameSize = 4 << 20;
+    static constexpr int DefaultLevel = 3;
+
+    using Bytes = std::vector<uint8_t>;
+
+    //Throws std::runtime_error on compression or write errors.
+    static void write(
+      int fd,
+      const uint8_t* data, size_t size,
+      size_t frameSize, int level, unsigned jobs);
+    //Returns the container. Throws std::runtime_error on compression errors.
+    static Bytes compress(
+      const uint8_t* data, size_t size,
+      size_t frameSize, int level, unsigned jobs);
+    //Throws std::runtime_error on malformed containers.
+    static Bytes read(const uint8_t* data, size_t size, unsigned jobs);
+    static bool isFrames(const uint8_t* data, size_t size);
+};
+
+#endif /* __SNL_FRAMES_H_ */
@@ -0,0 +1,115 @@
+#include "snl_order.h"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+bool SNLOrder::parse(const std::string& name, Type& type) {
+  if (name == "bfs") {
+    type = Type::BFS;
+  } else if (name == "rcm") {
+    type = Type::RCM;
+  } else if (name == "name") {
+    type = Type::Name;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+std::vector<size_t> SNLOrder::getOrder(
+  Type type,
+  const Graph& graph,
+  size_t bitsSize,
+  const std::vector<size_t>& seedBits) {
+  assert(type == Type::BFS or type == Type::RCM);
+  size_t instancesSize = graph.offsets_.size() - 1;
+  //transposed graph: instances of each bit
+  std::vector<size_t> bitOffsets(bitsSize + 1, 0);
+  for (auto bit: graph.bits_) {
+    ++bitOffsets[bit + 1];
+  }
+  for (size_t bit = 0; bit < bitsSize; ++bit) {
+    bitOffsets[bit + 1] += bitOffsets[bit];
+  }
+  std::vector<size_t> bitInstances(graph.bits_.size());
+  {
+    std::vector<size_t> cursors(bitOffsets.begin(), bitOffsets.end() - 1);
+    for (size_t i = 0; i < instancesSize; ++i) {
+      for (size_t k = graph.offsets_[i]; k < graph.offsets_[i + 1]; ++k) {
+        bitInstances[cursors[graph.bits_[k]]++] = i;
+      }
+    }
+  }
+  auto getDegree = [&](size_t i) {
+    return graph.offsets_[i + 1] - graph.offsets_[i];
+  };
+  auto byDegree = [&](size_t a, size_t b) {
+    return getDegree(a) < getDegree(b);
+  };
+
+  std::vector<bool> visited(instancesSize, false);
+  //each bit is followed once, so the traversal is linear in the bits
+  std::vector<bool> followed(bitsSize, false);
+  std::vector<size_t> neighbors;
+  auto follow = [&](size_t bit) {
+    if (followed[bit]) {
+      return;
+    }
+    followed[bit] = true;
+    if (bitOffsets[bit + 1] - bitOffsets[bit] > MaxFanout) {
+      return;
+    }
+    for (size_t k = bitOffsets[bit]; k < bitOffsets[bit + 1]; ++k) {
+      auto i = bitInstances[k];
+      if (not visited[i]) {
+        visited[i] = true;
+        neighbors.push_back(i);
+      }
+    }
+  };
+  //order is the BFS queue: instances before head have been expanded
+  std::vector<size_t> order;
+  order.reserve(instancesSize);
+  auto enqueueNeighbors = [&]() {
+    if (type == Type::RCM) {
+      std::stable_sort(neighbors.begin(), neighbors.end(), byDegree);
+    }
+    order.insert(order.end(), neighbors.begin(), neighbors.end());
+    neighbors.clear();
+  };
+  size_t head = 0;
+  auto expand = [&]() {
+    for (; head < order.size(); ++head) {
+      auto i = order[head];
+      for (size_t k = graph.offsets_[i]; k < graph.offsets_[i + 1]; ++k) {
+        follow(graph.bits_[k]);
+      }
+      enqueueNeighbors();
+    }
+  };
+
+  if (type == Type::BFS) {
+    for (auto bit: seedBits) {
+      follow(bit);
+    }
+    enqueueNeighbors();
+    expand();
+  }
+  std::vector<size_t> starts(instancesSize);
+  std::iota(starts.begin(), starts.end(), 0);
+  if (type == Type::RCM) {
+    std::stable_sort(starts.begin(), starts.end(), byDegree);
+  }
+  for (auto start: starts) {
+    if (not visited[start]) {
+      visited[start] = true;
+      order.push_back(start);
+      expand();
+    }
+  }
+  if (type == Type::RCM) {
+    std::reverse(order.begin(), order.end());
+  }
+  return order;
+}
@@ -0,0 +1,45 @@
+#ifndef __SNL_ORDER_H_
+#define __SNL_ORDER_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//Orders of the instances of a design improving locality
+//(write_naja-if -order). Naja stores instances and nets in arrays
+//indexed by their IDs: numbering connected objects close to each other
+//lets loaders and graph traversals walk memory mostly sequentially.
+//Instances are the vertices of a graph whose edges are the net bits
+//they share. Bits connecting more than MaxFanout instances (clocks,
+//resets) are not followed: they connect everything and carry no
+//locality.
+class SNLOrder {
+  public:
+    enum class Type { Default, BFS, RCM, Name };
+    static constexpr size_t MaxFanout = 64;
+
+    //Instance to net bits graph in CSR form: the bits of instance i are
+    //bits_[offsets_[i], offsets_[i+1])
+    struct Graph {
+      std::vector<size_t> offsets_  {0};
+      std::vector<size_t> bits_     {};
+    };
+
+    //bfs, rcm or name. Returns false on other names
+    static bool parse(const std::string& name, Type& type);
+
+    //Returns the instances of graph in BFS or RCM order:
+    //order[new ID] = ID.
+    //BFS starts from the instances on the seed bits (the design terms
+    //bits), then from the remaining instances in ID order.
+    //RCM is the reverse Cuthill-McKee order: each connected part starts
+    //from an instance of minimum degree, and neighbors are visited by
+    //increasing degree, the degree of an instance being its bits count.
+    static std::vector<size_t> getOrder(
+      Type type,
+      const Graph& graph,
+      size_t bitsSize,
+      const std::vector<size_t>& seedBits);
+};
+
+#endif /* __SNL_ORDER_H_ */
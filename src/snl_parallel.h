@@ -0,0 +1,55 @@
+#ifndef __SNL_PARALLEL_H_
+#define __SNL_PARALLEL_H_
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Calls task(i) for every i in [0, size) on up to jobs threads.
+//Indices are handed out one at a time so that uneven tasks
+//(large and small modules) stay balanced.
+//With jobs <= 1, tasks run in order on the calling thread.
+//The first exception thrown by a task is rethrown on the calling thread.
+template<typename Task>
+void parallelFor(size_t size, unsigned jobs, const Task& task) {
+  if (jobs <= 1 or size <= 1) {
+    for (size_t i = 0; i < size; ++i) {
+      task(i);
+    }
+    return;
+  }
+  std::atomic<size_t> next {0};
+  std::exception_ptr error {nullptr};
+  std::mutex errorMutex;
+  auto worker = [&]() {
+    for (size_t i = next++; i < size; i = next++) {
+      try {
+        task(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (not error) {
+          error = std::current_exception();
+        }
+        //stop handing out work
+        next = size;
+      }
+    }
+  };
+  size_t threadsSize = std::min<size_t>(jobs, size);
+  std::vector<std::thread> threads;
+  threads.reserve(threadsSize - 1);
+  for (size_t i = 1; i < threadsSize; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread: threads) {
+    thread.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+#endif /* __SNL_PARALLEL_H_ */
@@ -0,0 +1,324 @@
+#include "snl_reader.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <capnp/serialize.h>
+#include <capnp/serialize-packed.h>
+
+#include "snl_writer.h"
+#ifdef SNL_WITH_ZSTD
+#include "snl_frames.h"
+#endif
+
+namespace {
+
+capnp::ReaderOptions getReaderOptions() {
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = std::numeric_limits<uint64_t>::max();
+  return options;
+}
+
+}
+
+SNLManifest SNLManifest::read(const std::filesystem::path& dir) {
+  auto path = dir/"snl.mf";
+  std::ifstream stream(path);
+  if (not stream) {
+    throw std::runtime_error("cannot open " + path.string());
+  }
+  return parse(stream, path.string());
+}
+
+SNLManifest SNLManifest::parse(std::istream& stream, const std::string& source) {
+  SNLManifest manifest;
+  std::string line;
+  while (std::getline(stream, line)) {
+    std::istringstream fields(line);
+    std::string key;
+    fields >> key;
+    if (key == "E") {
+      std::string encoding;
+      fields >> encoding;
+      manifest.packed_ = encoding != "unpacked";
+    } else if (key == "L") {
+      std::string layout;
+      fields >> layout;
+      if (layout != "designs" and layout != "merged") {
+        throw std::runtime_error("unsupported layout in " + source + ": " + layout);
+      }
+      manifest.indexed_ = layout == "designs";
+    } else if (key == "C") {
+      std::string codec;
+      fields >> codec;
+      if (codec == "zstd") {
+        manifest.compressed_ = true;
+        fields >> manifest.frameSize_;
+      } else if (codec != "none") {
+        throw std::runtime_error("unsupported compression in " + source + ": " + codec);
+      }
+    }
+  }
+  return manifest;
+}
+
+SNLMessage::SNLMessage(const std::filesystem::path& path, const SNLManifest& manifest, unsigned jobs) {
+  map(path, 0, 0);
+  decode(path.string(), manifest, jobs);
+}
+
+SNLMessage::SNLMessage(
+  const std::filesystem::path& path,
+  uint64_t offset,
+  uint64_t length,
+  const SNLManifest& manifest,
+  unsigned jobs) {
+  if (length == 0) {
+    throw std::runtime_error("empty message in " + path.string());
+  }
+  map(path, offset, length);
+  decode(path.string() + "@" + std::to_string(offset), manifest, jobs);
+}
+
+//Maps length bytes at offset of path, the whole file when length is 0
+void SNLMessage::map(const std::filesystem::path& path, uint64_t offset, uint64_t length) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("cannot open " + path.string() + ": " + strerror(errno));
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 or status.st_size == 0) {
+    close(fd);
+    throw std::runtime_error("cannot read " + path.string());
+  }
+  uint64_t fileSize = status.st_size;
+  if (length == 0) {
+    length = fileSize;
+  }
+  if (offset > fileSize or length > fileSize - offset) {
+    close(fd);
+    throw std::runtime_error("message beyond the end of " + path.string());
+  }
+  //mmap offsets are multiples of the page size
+  uint64_t pageSize = sysconf(_SC_PAGESIZE);
+  uint64_t mapStart = offset - offset % pageSize;
+  mapOffset_ = offset - mapStart;
+  mapSize_ = mapOffset_ + length;
+  map_ = mmap(nullptr, mapSize_, PROT_READ, MAP_PRIVATE, fd, mapStart);
+  close(fd);
+  if (map_ == MAP_FAILED) {
+    map_ = nullptr;
+    throw std::runtime_error("cannot map " + path.string() + ": " + strerror(errno));
+  }
+}
+
+SNLMessage::SNLMessage(
+  std::vector<uint8_t>&& bytes,
+  const std::string& name,
+  const SNLManifest& manifest,
+  unsigned jobs): bytes_(std::move(bytes)) {
+  decode(name, manifest, jobs);
+}
+
+//Decodes the mapping, or bytes_ when nothing is mapped
+void SNLMessage::decode(const std::string& name, const SNLManifest& manifest, unsigned jobs) {
+  auto data = map_ ? static_cast<const uint8_t*>(map_) + mapOffset_ : bytes_.data();
+  size_t size = map_ ? mapSize_ - mapOffset_ : bytes_.size();
+  try {
+    if (manifest.compressed_) {
+#ifdef SNL_WITH_ZSTD
+      bytes_ = SNLFrames::read(data, size, jobs);
+      if (map_) {
+        munmap(map_, mapSize_);
+        map_ = nullptr;
+      }
+      data = bytes_.data();
+      size = bytes_.size();
+#else
+      throw std::runtime_error("compressed and the plugin was built without zstd support");
+#endif
+    }
+    if (manifest.packed_) {
+      stream_ = std::make_unique<kj::ArrayInputStream>(kj::ArrayPtr<const kj::byte>(data, size));
+      reader_ = std::make_unique<capnp::PackedMessageReader>(*stream_, getReaderOptions());
+    } else {
+      if (size % sizeof(capnp::word) != 0) {
+        throw std::runtime_error("truncated message");
+      }
+      //in place: the mapping or the decompressed bytes stay alive with the reader
+      reader_ = std::make_unique<capnp::FlatArrayMessageReader>(
+        kj::ArrayPtr<const capnp::word>(
+          reinterpret_cast<const capnp::word*>(data), size / sizeof(capnp::word)),
+        getReaderOptions());
+    }
+  } catch (const std::exception& e) {
+    release();
+    throw std::runtime_error("cannot decode " + name + ": " + e.what());
+  } catch (...) {
+    //kj exceptions
+    release();
+    throw std::runtime_error("cannot decode " + name);
+  }
+}
+
+SNLMessage::~SNLMessage() {
+  release();
+}
+
+void SNLMessage::release() {
+  reader_.reset();
+  stream_.reset();
+  if (map_) {
+    munmap(map_, mapSize_);
+    map_ = nullptr;
+  }
+}
+
+const SNLDesignsIndex::Entry* SNLDesignsIndex::find(uint32_t libraryID, uint32_t designID) const {
+  for (const auto& entry: entries_) {
+    if (entry.libraryID_ == libraryID and entry.designID_ == designID) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+SNLDesignsIndex SNLDesignsIndex::read(const std::filesystem::path& dir) {
+  auto path = dir/"db_designs.idx";
+  std::ifstream stream(path);
+  if (not stream) {
+    throw std::runtime_error("cannot open " + path.string());
+  }
+  SNLDesignsIndex index;
+  std::string line;
+  while (std::getline(stream, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    std::istringstream fields(line);
+    Entry entry;
+    if (not (fields >> entry.libraryID_ >> entry.designID_ >> entry.fileName_
+      >> entry.offset_ >> entry.length_ >> entry.instances_ >> entry.nets_)) {
+      throw std::runtime_error("malformed line in " + path.string() + ": " + line);
+    }
+    index.entries_.push_back(std::move(entry));
+  }
+  return index;
+}
+
+namespace {
+
+//Accepts one connection on a new Unix domain socket at path
+int acceptStream(const std::string& path) {
+  sockaddr_un address {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("socket path too long: " + path);
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    throw std::runtime_error(std::string("socket: ") + strerror(errno));
+  }
+  if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+    or listen(listener, 1) != 0) {
+    auto error = "cannot listen on " + path + ": " + strerror(errno);
+    close(listener);
+    throw std::runtime_error(error);
+  }
+  int fd = accept(listener, nullptr, nullptr);
+  auto acceptError = errno;
+  close(listener);
+  unlink(path.c_str());
+  if (fd < 0) {
+    throw std::runtime_error("cannot accept on " + path + ": " + strerror(acceptError));
+  }
+  return fd;
+}
+
+}
+
+SNLStreamReader::SNLStreamReader(const std::string& source) {
+  if (source.compare(0, 3, "fd:") == 0) {
+    char* end = nullptr;
+    auto fd = strtol(source.c_str() + 3, &end, 10);
+    if (end == source.c_str() + 3 or *end != '\0' or fd < 0 or fcntl(fd, F_GETFD) < 0) {
+      throw std::runtime_error("invalid file descriptor " + source);
+    }
+    fd_ = fd;
+  } else {
+    struct stat status;
+    if (stat(source.c_str(), &status) == 0 and not S_ISSOCK(status.st_mode)) {
+      //blocks until a producer opens a FIFO
+      fd_ = open(source.c_str(), O_RDONLY);
+      if (fd_ < 0) {
+        throw std::runtime_error("cannot open " + source + ": " + strerror(errno));
+      }
+    } else {
+      if (stat(source.c_str(), &status) == 0) {
+        //left by a previous consumer
+        unlink(source.c_str());
+      }
+      fd_ = acceptStream(source);
+    }
+  }
+  try {
+    char magic[sizeof(SNLWriter::StreamMagic)];
+    uint32_t version = 0;
+    read(magic, sizeof(magic));
+    read(&version, sizeof(version));
+    if (std::memcmp(magic, SNLWriter::StreamMagic, sizeof(magic)) != 0
+      or version != SNLWriter::StreamVersion) {
+      throw std::runtime_error("not an SNL stream or unsupported version: " + source);
+    }
+  } catch (...) {
+    //the destructor does not run when the constructor throws
+    close(fd_);
+    throw;
+  }
+}
+
+SNLStreamReader::~SNLStreamReader() {
+  close(fd_);
+}
+
+bool SNLStreamReader::next(std::string& name, std::vector<uint8_t>& bytes) {
+  uint32_t nameSize = 0;
+  read(&nameSize, sizeof(nameSize));
+  if (nameSize == 0) {
+    return false;
+  }
+  name.resize(nameSize);
+  read(name.data(), nameSize);
+  uint64_t size = 0;
+  read(&size, sizeof(size));
+  bytes.resize(size);
+  read(bytes.data(), size);
+  return true;
+}
+
+void SNLStreamReader::read(void* data, size_t size) {
+  auto position = static_cast<uint8_t*>(data);
+  while (size > 0) {
+    auto count = ::read(fd_, position, size);
+    if (count < 0 and errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      throw std::runtime_error(count == 0 ? "truncated SNL stream"
+        : std::string("SNL stream read error: ") + strerror(errno));
+    }
+    position += count;
+    size -= count;
+  }
+}
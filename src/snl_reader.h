@@ -0,0 +1,114 @@
+#ifndef __SNL_READER_H_
+#define __SNL_READER_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef VOID
+#undef VOID
+#endif
+#include <capnp/message.h>
+#include <kj/io.h>
+
+//Contents of the snl.mf manifest of an export directory that readers
+//need to decode the .snl files.
+struct SNLManifest {
+  bool    packed_     {true};
+  bool    compressed_ {false};
+  size_t  frameSize_  {0};
+  //one message per design, located by db_designs.idx
+  bool    indexed_    {false};
+
+  //Throws std::runtime_error if the manifest cannot be read
+  static SNLManifest read(const std::filesystem::path& dir);
+  //source names the manifest in errors
+  static SNLManifest parse(std::istream& stream, const std::string& source);
+};
+
+//One .snl message, decoded according to the manifest.
+//Unpacked and uncompressed files are mapped and read in place, without
+//copy. Compressed files are first decompressed in parallel.
+class SNLMessage {
+  public:
+    //Throws std::runtime_error if the file cannot be read
+    SNLMessage(const std::filesystem::path& path, const SNLManifest& manifest, unsigned jobs);
+    //Message of length bytes at offset in path, only this range is mapped
+    SNLMessage(
+      const std::filesystem::path& path,
+      uint64_t offset,
+      uint64_t length,
+      const SNLManifest& manifest,
+      unsigned jobs);
+    //Message read from a stream item, decoded in place
+    SNLMessage(std::vector<uint8_t>&& bytes, const std::string& name, const SNLManifest& manifest, unsigned jobs);
+    ~SNLMessage();
+    SNLMessage(const SNLMessage&) = delete;
+    SNLMessage& operator=(const SNLMessage&) = delete;
+
+    template<typename T>
+    typename T::Reader getRoot() {
+      return reader_->getRoot<T>();
+    }
+
+  private:
+    void map(const std::filesystem::path& path, uint64_t offset, uint64_t length);
+    void decode(const std::string& name, const SNLManifest& manifest, unsigned jobs);
+    void release();
+
+    void*                                 map_        {nullptr};
+    size_t                                mapSize_    {0};
+    //start of the message in the mapping, which starts on a page
+    size_t                                mapOffset_  {0};
+    std::vector<uint8_t>                  bytes_    {};
+    std::unique_ptr<kj::ArrayInputStream> stream_   {};
+    std::unique_ptr<capnp::MessageReader> reader_   {};
+};
+
+//Lines of db_designs.idx, written by write_naja-if -index: where the
+//message of each design is, and its size.
+struct SNLDesignsIndex {
+  struct Entry {
+    uint32_t    libraryID_  {0};
+    uint32_t    designID_   {0};
+    std::string fileName_   {};
+    uint64_t    offset_     {0};
+    uint64_t    length_     {0};
+    size_t      instances_  {0};
+    size_t      nets_       {0};
+  };
+  std::vector<Entry> entries_ {};
+
+  const Entry* find(uint32_t libraryID, uint32_t designID) const;
+
+  //Throws std::runtime_error if the index cannot be read
+  static SNLDesignsIndex read(const std::filesystem::path& dir);
+};
+
+//Items of a stream written by write_naja-if -stream (see snl_writer.h),
+//read as they arrive.
+class SNLStreamReader {
+  public:
+    //source is fd:<N> for an inherited file descriptor, the path of a
+    //FIFO or of a file, or otherwise the path of a Unix domain socket
+    //created to accept one producer connection.
+    //Throws std::runtime_error
+    SNLStreamReader(const std::string& source);
+    ~SNLStreamReader();
+    SNLStreamReader(const SNLStreamReader&) = delete;
+    SNLStreamReader& operator=(const SNLStreamReader&) = delete;
+
+    //Reads the next item. Returns false at the end of the stream.
+    //Throws std::runtime_error on truncated or malformed streams
+    bool next(std::string& name, std::vector<uint8_t>& bytes);
+
+  private:
+    void read(void* data, size_t size);
+
+    int fd_ {-1};
+};
+
+#endif /* __SNL_READER_H_ */
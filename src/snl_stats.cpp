@@ -0,0 +1,112 @@
+#include "snl_stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sys/resource.h>
+
+namespace {
+
+template<typename T>
+T& getEntry(std::vector<std::pair<std::string, T>>& entries, const std::string& name) {
+  auto it = std::find_if(entries.begin(), entries.end(),
+    [&](const auto& entry) { return entry.first == name; });
+  if (it == entries.end()) {
+    entries.emplace_back(name, T(0));
+    return entries.back().second;
+  }
+  return it->second;
+}
+
+//Quoted JSON string: file names may contain quotes, backslashes or
+//control characters
+std::string getJSONString(const std::string& text) {
+  std::string json = "\"";
+  for (unsigned char c: text) {
+    if (c == '"' or c == '\\') {
+      json += '\\';
+      json += c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      json += escaped;
+    } else {
+      json += c;
+    }
+  }
+  return json + '"';
+}
+
+template<typename T>
+void writeEntries(
+  std::ostream& stream,
+  const std::string& name,
+  const std::vector<std::pair<std::string, T>>& entries,
+  bool last = false) {
+  stream << "  \"" << name << "\": {";
+  bool first = true;
+  for (const auto& [key, value]: entries) {
+    stream << (first ? "\n" : ",\n") << "    " << getJSONString(key) << ": " << value;
+    first = false;
+  }
+  stream << (first ? "}" : "\n  }") << (last ? "\n" : ",\n");
+}
+
+}
+
+SNLStats::Timer::Timer(SNLStats* stats, const std::string& phase):
+  stats_(stats), phase_(phase), start_(Clock::now())
+{}
+
+SNLStats::Timer::~Timer() {
+  if (stats_) {
+    stats_->addPhase(phase_, getSeconds(start_, Clock::now()));
+  }
+}
+
+double SNLStats::getSeconds(Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration<double>(end - start).count();
+}
+
+void SNLStats::addPhase(const std::string& phase, double seconds) {
+  getEntry(phases_, phase) += seconds;
+}
+
+void SNLStats::addCounter(const std::string& counter, uint64_t value) {
+  getEntry(counters_, counter) += value;
+}
+
+void SNLStats::maxCounter(const std::string& counter, uint64_t value) {
+  auto& entry = getEntry(counters_, counter);
+  entry = std::max(entry, value);
+}
+
+void SNLStats::addFile(const std::filesystem::path& path) {
+  std::error_code error;
+  auto size = std::filesystem::file_size(path, error);
+  getEntry(files_, path.filename().string()) = error ? 0 : size;
+}
+
+uint64_t SNLStats::getPeakRSS() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  //bytes on macOS
+  return usage.ru_maxrss;
+#else
+  //kilobytes on Linux
+  return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+void SNLStats::write(const std::filesystem::path& path) const {
+  std::ofstream stream(path, std::ofstream::out);
+  stream << "{\n";
+  writeEntries(stream, "phases_seconds", phases_);
+  stream << "  \"peak_rss_bytes\": " << getPeakRSS() << ",\n";
+  writeEntries(stream, "file_bytes", files_);
+  writeEntries(stream, "counters", counters_, true);
+  stream << "}\n";
+}
@@ -0,0 +1,51 @@
+#ifndef __SNL_STATS_H_
+#define __SNL_STATS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+//Export statistics written by write_naja-if -stats: wall time per phase,
+//peak RSS, bytes per written file and object counters.
+//Not thread safe: workers accumulate their own counters that are then
+//merged from the calling thread.
+class SNLStats {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    //Adds the time elapsed between construction and destruction
+    //to a phase. Does nothing when stats is null.
+    class Timer {
+      public:
+        Timer(SNLStats* stats, const std::string& phase);
+        ~Timer();
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+      private:
+        SNLStats*         stats_;
+        std::string       phase_;
+        Clock::time_point start_;
+    };
+
+    static double getSeconds(Clock::time_point start, Clock::time_point end);
+
+    void addPhase(const std::string& phase, double seconds);
+    void addCounter(const std::string& counter, uint64_t value);
+    void maxCounter(const std::string& counter, uint64_t value);
+    void addFile(const std::filesystem::path& path);
+    void write(const std::filesystem::path& path) const;
+
+    static uint64_t getPeakRSS();
+
+  private:
+    using Values = std::vector<std::pair<std::string, double>>;
+    using Counters = std::vector<std::pair<std::string, uint64_t>>;
+    Values    phases_   {};
+    Counters  counters_ {};
+    Counters  files_    {};
+};
+
+#endif /* __SNL_STATS_H_ */
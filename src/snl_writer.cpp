@@ -0,0 +1,293 @@
+#include "snl_writer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <utility>
+
+#ifdef VOID
+#undef VOID
+#endif
+#include <kj/exception.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double getSeconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string getError(const std::string& operation) {
+  return operation + ": " + strerror(errno);
+}
+
+//bytes written by writeAll on this thread, checked against the
+//announced size of stream items
+thread_local size_t writtenBytes = 0;
+
+template<typename T>
+void append(std::string& bytes, T value) {
+  bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+//Makes the rename of a file of dir durable. Best effort: some file
+//systems do not support syncing directories.
+void syncDirectory(const std::filesystem::path& dir) {
+  int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+void writeFile(const std::filesystem::path& path, const SNLWriter::Content& content) {
+  auto temporaryPath = path;
+  temporaryPath += ".tmp";
+  int fd = open(
+    temporaryPath.c_str(),
+    O_CREAT | O_WRONLY | O_TRUNC,
+    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0) {
+    throw std::runtime_error(getError("open " + temporaryPath.string()));
+  }
+  std::error_code ignored;
+  try {
+    content(fd);
+    if (fsync(fd) != 0) {
+      throw std::runtime_error(getError("fsync"));
+    }
+  } catch (...) {
+    close(fd);
+    std::filesystem::remove(temporaryPath, ignored);
+    throw;
+  }
+  if (close(fd) != 0) {
+    auto error = getError("close");
+    std::filesystem::remove(temporaryPath, ignored);
+    throw std::runtime_error(error);
+  }
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, path, error);
+  if (error) {
+    std::filesystem::remove(temporaryPath, ignored);
+    throw std::runtime_error("rename: " + error.message());
+  }
+  syncDirectory(path.parent_path());
+}
+
+}
+
+SNLWriter::SNLWriter(size_t maxPending):
+  maxPending_(std::max<size_t>(maxPending, 1)),
+  thread_([this]() { run(); })
+{}
+
+SNLWriter::SNLWriter(int streamFD, size_t maxPending):
+  maxPending_(std::max<size_t>(maxPending, 1)),
+  streamFD_(streamFD),
+  thread_([this]() { run(); })
+{}
+
+SNLWriter::~SNLWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  changed_.notify_all();
+  thread_.join();
+  if (isStream()) {
+    close(streamFD_);
+  }
+}
+
+void SNLWriter::writeAll(int fd, const void* data, size_t size) {
+  auto position = static_cast<const char*>(data);
+  while (size > 0) {
+    auto written = ::write(fd, position, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(getError("write"));
+    }
+    position += written;
+    size -= written;
+    writtenBytes += written;
+  }
+}
+
+int SNLWriter::openStream(const std::string& target) {
+  if (target.compare(0, 3, "fd:") == 0) {
+    char* end = nullptr;
+    auto fd = strtol(target.c_str() + 3, &end, 10);
+    if (end == target.c_str() + 3 or *end != '\0' or fd < 0 or fcntl(fd, F_GETFD) < 0) {
+      throw std::runtime_error("invalid file descriptor " + target);
+    }
+    return fd;
+  }
+  struct stat status;
+  if (stat(target.c_str(), &status) == 0 and S_ISSOCK(status.st_mode)) {
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (target.size() >= sizeof(address.sun_path)) {
+      throw std::runtime_error("socket path too long: " + target);
+    }
+    std::memcpy(address.sun_path, target.c_str(), target.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+      throw std::runtime_error(getError("socket"));
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+      auto error = getError("connect " + target);
+      close(fd);
+      throw std::runtime_error(error);
+    }
+    return fd;
+  }
+  //blocks until a consumer opens a FIFO
+  int fd = open(
+    target.c_str(),
+    O_CREAT | O_WRONLY | O_TRUNC,
+    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0) {
+    throw std::runtime_error(getError("open " + target));
+  }
+  return fd;
+}
+
+void SNLWriter::write(const std::filesystem::path& path, Content content, size_t size) {
+  push(File {path, std::move(content), size, false});
+}
+
+void SNLWriter::writeText(const std::filesystem::path& path, const std::string& text) {
+  write(path, [text](int fd) {
+    writeAll(fd, text.data(), text.size());
+  }, text.size());
+}
+
+void SNLWriter::writeEnd() {
+  if (isStream()) {
+    push(File {{}, nullptr, 0, true});
+  }
+}
+
+void SNLWriter::push(File&& file) {
+  auto start = Clock::now();
+  std::unique_lock<std::mutex> lock(mutex_);
+  //the file being written counts: with maxPending 1, the caller builds
+  //the next message while the previous one is written, not two ahead
+  changed_.wait(lock, [this]() { return files_.size() + writing_ < maxPending_; });
+  report_.waitSeconds_ += getSeconds(start);
+  files_.push_back(std::move(file));
+  changed_.notify_all();
+}
+
+SNLWriter::Report SNLWriter::finish() {
+  auto start = Clock::now();
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this]() { return files_.empty() and not writing_; });
+  report_.waitSeconds_ += getSeconds(start);
+  return std::exchange(report_, Report());
+}
+
+void SNLWriter::writeItem(const File& file) {
+  if (streamFailed_) {
+    throw std::runtime_error("stream interrupted by a previous error");
+  }
+  std::string header;
+  if (not streamStarted_) {
+    header.append(StreamMagic, sizeof(StreamMagic));
+    append<uint32_t>(header, StreamVersion);
+    streamStarted_ = true;
+  }
+  if (file.end_) {
+    append<uint32_t>(header, 0);
+    writeAll(streamFD_, header.data(), header.size());
+    return;
+  }
+  if (file.size_ == UnknownSize) {
+    throw std::runtime_error("stream item of unknown size");
+  }
+  auto name = file.path_.filename().string();
+  append<uint32_t>(header, name.size());
+  header += name;
+  append<uint64_t>(header, file.size_);
+  writeAll(streamFD_, header.data(), header.size());
+  writtenBytes = 0;
+  file.content_(streamFD_);
+  if (writtenBytes != file.size_) {
+    //the stream cannot be decoded past this item
+    throw std::runtime_error(
+      "stream item of " + std::to_string(file.size_)
+      + " bytes written as " + std::to_string(writtenBytes) + " bytes");
+  }
+}
+
+void SNLWriter::run() {
+  if (isStream()) {
+    //a consumer closing the stream gives EPIPE errors instead of
+    //killing the process
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    changed_.wait(lock, [this]() { return stopped_ or not files_.empty(); });
+    if (files_.empty()) {
+      return;
+    }
+    auto file = std::move(files_.front());
+    files_.pop_front();
+    writing_ = true;
+    changed_.notify_all();
+    lock.unlock();
+
+    auto start = Clock::now();
+    std::string error;
+    try {
+      if (isStream()) {
+        writeItem(file);
+      } else {
+        writeFile(file.path_, file.content_);
+      }
+    } catch (const std::exception& e) {
+      error = e.what();
+    } catch (const kj::Exception& e) {
+      //capnp serialization errors
+      error = e.getDescription().cStr();
+    } catch (...) {
+      error = "unknown error";
+    }
+    if (isStream() and not error.empty()) {
+      streamFailed_ = true;
+    }
+    //release the message before the next one is queued
+    file.content_ = nullptr;
+    auto seconds = getSeconds(start);
+
+    lock.lock();
+    writing_ = false;
+    report_.writeSeconds_ += seconds;
+    if (error.empty()) {
+      if (not file.end_) {
+        report_.files_.push_back(file.path_);
+      }
+    } else {
+      auto name = file.end_ ? std::string("the end of the stream") : file.path_.string();
+      report_.errors_.push_back("Cannot write " + name + ": " + error);
+    }
+    changed_.notify_all();
+  }
+}
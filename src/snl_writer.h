@@ -0,0 +1,105 @@
+#ifndef __SNL_WRITER_H_
+#define __SNL_WRITER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Writes the files of an export on a background thread, in order, while
+//the caller builds the next message.
+//Each file is written to <path>.tmp with every write checked, fsynced,
+//then renamed into place: a file is either complete or left as it was.
+//At most maxPending files are queued or being written, write blocks
+//beyond, so that the memory of pending messages stays bounded.
+//Errors are collected and returned by finish to the calling thread,
+//which reports them.
+//
+//In stream mode (write_naja-if -stream), files are written as items of
+//a single stream instead, for a consumer reading them as they come:
+//  magic "NJSS", uint32 version
+//  per file: uint32 name size, file name, uint64 content size, content
+//  end: uint32 0
+//(little endian). Items are neither synced nor renamed, and no item is
+//written after an error.
+class SNLWriter {
+  public:
+    //Writes the file content to fd. Throws on errors.
+    using Content = std::function<void(int fd)>;
+
+    static constexpr char StreamMagic[4] = {'N', 'J', 'S', 'S'};
+    static constexpr uint32_t StreamVersion = 1;
+    static constexpr size_t UnknownSize = SIZE_MAX;
+
+    struct Report {
+      std::vector<std::filesystem::path>  files_        {};
+      std::vector<std::string>            errors_       {};
+      //time spent writing on the background thread
+      double                              writeSeconds_ {0};
+      //time the caller was blocked by write and finish
+      double                              waitSeconds_  {0};
+    };
+
+    SNLWriter(size_t maxPending = 1);
+    //Stream mode on streamFD, closed by the destructor
+    SNLWriter(int streamFD, size_t maxPending = 1);
+    //Waits for the queued files
+    ~SNLWriter();
+    SNLWriter(const SNLWriter&) = delete;
+    SNLWriter& operator=(const SNLWriter&) = delete;
+
+    //Writes size bytes of data to fd, retrying interrupted writes.
+    //Stream contents must write through it: the bytes are counted and
+    //an item of another size than announced fails the stream.
+    //Throws std::runtime_error
+    static void writeAll(int fd, const void* data, size_t size);
+
+    //Opens a stream target: fd:<N> for an inherited file descriptor,
+    //the path of a listening Unix domain socket, or of a FIFO or file.
+    //Throws std::runtime_error
+    static int openStream(const std::string& target);
+
+    bool isStream() const { return streamFD_ >= 0; }
+    //size is the number of bytes content writes, required in stream mode
+    void write(const std::filesystem::path& path, Content content, size_t size = UnknownSize);
+    void writeText(const std::filesystem::path& path, const std::string& text);
+    //Queues the end of the stream, does nothing on files
+    void writeEnd();
+    //Waits for the queued files and returns the report of the files
+    //written since the previous call
+    Report finish();
+
+  private:
+    struct File {
+      std::filesystem::path path_;
+      Content               content_;
+      size_t                size_;
+      //end of stream marker
+      bool                  end_;
+    };
+
+    void run();
+    void push(File&& file);
+    void writeItem(const File& file);
+
+    size_t                  maxPending_;
+    int                     streamFD_       {-1};
+    //writer thread only
+    bool                    streamStarted_  {false};
+    bool                    streamFailed_   {false};
+    std::mutex              mutex_          {};
+    std::condition_variable changed_        {};
+    std::deque<File>        files_          {};
+    bool                    writing_        {false};
+    bool                    stopped_        {false};
+    Report                  report_         {};
+    //last: started once the queue is initialized
+    std::thread             thread_;
+};
+
+#endif /* __SNL_WRITER_H_ */
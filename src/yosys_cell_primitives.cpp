@@ -0,0 +1,114 @@
+#include "yosys_cell_primitives.h"
+
+#include "kernel/celltypes.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <set>
+#include <vector>
+
+USING_YOSYS_NAMESPACE
+
+namespace {
+
+constexpr char SignedSuffix[] = "_SIGNED";
+//not $: Yosys would take generated primitives for internal cells
+constexpr char NamePrefix[] = "\\yosys_";
+
+//no outputs: debug output, formal properties and timing annotations
+const char* IgnoredTypes[] = {
+  "$print", "$check", "$scopeinfo",
+  "$assert", "$assume", "$live", "$fair", "$cover",
+  "$specify2", "$specify3", "$specrule",
+};
+
+//Port of a *_SIGNED parameter name, empty for other parameters
+std::string getSignedPort(const RTLIL::IdString& parameter) {
+  auto name = RTLIL::unescape_id(parameter.str());
+  size_t suffixSize = strlen(SignedSuffix);
+  if (name.size() <= suffixSize
+    or name.compare(name.size() - suffixSize, suffixSize, SignedSuffix) != 0) {
+    return std::string();
+  }
+  return name.substr(0, name.size() - suffixSize);
+}
+
+//Connected ports of cell, with their width, sorted by name.
+//Ports connected to nothing (width 0) are not part of the variant.
+using Port = std::pair<const RTLIL::IdString*, int>;
+std::vector<Port> getPorts(const RTLIL::Cell* cell) {
+  std::vector<Port> ports;
+  for (const auto& [name, sig]: cell->connections()) {
+    if (sig.size() > 0) {
+      ports.emplace_back(&name, sig.size());
+    }
+  }
+  std::sort(ports.begin(), ports.end(), [](const Port& a, const Port& b) {
+    return strcmp(a.first->c_str(), b.first->c_str()) < 0;
+  });
+  return ports;
+}
+
+}
+
+std::string YosysCellPrimitives::getSignature(const RTLIL::Cell* cell) {
+  std::set<std::string> signedPorts;
+  for (const auto& [name, value]: cell->parameters) {
+    auto port = getSignedPort(name);
+    if (not port.empty() and value.as_bool()) {
+      signedPorts.insert(port);
+    }
+  }
+  //type without its $
+  auto signature = NamePrefix + cell->type.str().substr(1);
+  for (const auto& [name, width]: getPorts(cell)) {
+    auto port = RTLIL::unescape_id(name->str());
+    signature += "_" + port + "_" + std::to_string(width);
+    if (signedPorts.count(port)) {
+      signature += "s";
+    }
+  }
+  return signature;
+}
+
+bool YosysCellPrimitives::isIgnored(const RTLIL::Cell* cell) {
+  auto type = cell->type.c_str();
+  return std::any_of(std::begin(IgnoredTypes), std::end(IgnoredTypes), [type](const char* ignored) {
+    return strcmp(type, ignored) == 0;
+  });
+}
+
+RTLIL::Module* YosysCellPrimitives::add(const RTLIL::Cell* cell) {
+  if (not cell->type.begins_with("$") or not yosys_celltypes.cell_known(cell->type)
+    or isIgnored(cell)) {
+    return nullptr;
+  }
+  auto signature = getSignature(cell);
+  auto& primitive = variants_[signature];
+  if (not primitive) {
+    primitive = std::make_unique<RTLIL::Module>();
+    primitive->name = RTLIL::IdString(signature);
+    primitive->set_bool_attribute(ID::blackbox);
+    //values are instance parameters, except the signedness of the variant
+    for (const auto& [name, value]: cell->parameters) {
+      primitive->avail_parameters.insert(name);
+      if (not getSignedPort(name).empty()) {
+        primitive->parameter_default_values[name] = value;
+      }
+    }
+    for (const auto& [name, width]: getPorts(cell)) {
+      auto wire = primitive->addWire(*name, width);
+      wire->port_input = cell->input(*name);
+      wire->port_output = cell->output(*name);
+      if (not wire->port_input and not wire->port_output) {
+        //direction unknown to Yosys
+        wire->port_input = wire->port_output = true;
+      }
+    }
+    //ports numbered in name order
+    primitive->fixup_ports();
+  }
+  cells_[cell] = primitive.get();
+  return primitive.get();
+}
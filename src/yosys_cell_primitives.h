@@ -0,0 +1,46 @@
+#ifndef __YOSYS_CELL_PRIMITIVES_H_
+#define __YOSYS_CELL_PRIMITIVES_H_
+
+#include "kernel/yosys.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+//Primitives generated for the Yosys internal cells ($and, $dff, $mux...),
+//which have no module, so that coarse grained RTLIL is exported without
+//a techmap to gates.
+//Cells of a type come in variants: one blackbox module is generated per
+//variant, keyed by a signature of the type, the width of each connected
+//port (directions follow from the type) and the *_SIGNED parameters, and
+//named after it, for instance yosys_add_A_8s_B_8s_Y_9. Names do not start
+//with $, which Yosys reserves for its internal cells. Each variant is
+//exported once and shared by all its cells.
+//Generated modules are not added to the design and are owned here.
+class YosysCellPrimitives {
+  public:
+    using Cells = Yosys::dict<const Yosys::RTLIL::Cell*, Yosys::RTLIL::Module*>;
+
+    //Returns the primitive of the variant of cell, generated for the
+    //first cell of the variant, or nullptr if cell is not an internal
+    //cell known to Yosys or is ignored.
+    //Creates IdStrings: call from the main thread only.
+    Yosys::RTLIL::Module* add(const Yosys::RTLIL::Cell* cell);
+
+    //Cells passed to add and their primitive
+    const Cells& getCells() const { return cells_; }
+    size_t getVariantsSize() const { return variants_.size(); }
+
+    static std::string getSignature(const Yosys::RTLIL::Cell* cell);
+    //Internal cells without netlist meaning ($print, $check, $scopeinfo,
+    //formal properties, specify timing...), which are not exported.
+    //Compares type names without creating IdStrings: safe on workers.
+    static bool isIgnored(const Yosys::RTLIL::Cell* cell);
+
+  private:
+    //by signature
+    std::map<std::string, std::unique_ptr<Yosys::RTLIL::Module>>  variants_ {};
+    Cells                                                         cells_    {};
+};
+
+#endif /* __YOSYS_CELL_PRIMITIVES_H_ */
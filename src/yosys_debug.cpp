@@ -1,7 +1,104 @@
 #include "yosys_debug.h"
 
+#include <mutex>
+
 USING_YOSYS_NAMESPACE
 
+namespace {
+
+struct CategoryName {
+  YosysTrace::Category  category_;
+  const char*           name_;
+};
+
+constexpr CategoryName CategoryNames[] = {
+  {YosysTrace::Modules,     "modules"},
+  {YosysTrace::Terms,       "terms"},
+  {YosysTrace::Parameters,  "parameters"},
+  {YosysTrace::Nets,        "nets"},
+  {YosysTrace::Instances,   "instances"},
+  {YosysTrace::Components,  "components"}
+};
+
+const char* getCategoryName(YosysTrace::Category category) {
+  for (const auto& categoryName: CategoryNames) {
+    if (categoryName.category_ == category) {
+      return categoryName.name_;
+    }
+  }
+  return "trace";
+}
+
+std::mutex traceMutex;
+
+}
+
+std::atomic<uint32_t> YosysTrace::categories_ {0};
+std::string YosysTrace::pattern_ {};
+
+//pattern_ is set before the trace points run, workers only read it
+YosysTrace::Scope::Scope(uint32_t categories, const std::string& pattern) {
+  pattern_ = pattern;
+  categories_.store(categories, std::memory_order_relaxed);
+}
+
+YosysTrace::Scope::~Scope() {
+  categories_.store(0, std::memory_order_relaxed);
+  pattern_.clear();
+}
+
+bool YosysTrace::parseCategories(const std::string& text, uint32_t& categories) {
+  categories = 0;
+  std::istringstream stream(text);
+  std::string name;
+  while (std::getline(stream, name, ',')) {
+    if (name == "all") {
+      categories |= All;
+      continue;
+    }
+    bool found = false;
+    for (const auto& categoryName: CategoryNames) {
+      if (name == categoryName.name_) {
+        categories |= categoryName.category_;
+        found = true;
+      }
+    }
+    if (not found) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string YosysTrace::getCategoryNames() {
+  std::string names;
+  for (const auto& categoryName: CategoryNames) {
+    names += categoryName.name_;
+    names += ", ";
+  }
+  return names + "all";
+}
+
+bool YosysTrace::matches(const char* moduleName, const char* name) {
+  if (pattern_.empty()) {
+    return true;
+  }
+  //public names are matched without their escape, as in select patterns
+  auto match = [](const char* name) {
+    if (not name) {
+      return false;
+    }
+    return patmatch(pattern_.c_str(), *name == '\\' ? name + 1 : name);
+  };
+  return match(moduleName) or match(name);
+}
+
+void YosysTrace::write(Category category, const std::string& message) {
+  //log() is not thread safe
+  std::lock_guard<std::mutex> lock(traceMutex);
+  std::cerr << "[naja-if " << getCategoryName(category) << "] " << message << std::endl;
+}
+
 void YosysDebug::print(const RTLIL::Wire* w, size_t indent, std::ostream& stream) {
   stream << std::string(indent, ' ') << "Wire:" << std::endl;
 	stream << std::string(indent+2, ' ') << w->module->name.c_str() << std::endl;
@@ -23,7 +120,7 @@ void YosysDebug::print(const RTLIL::Cell* c, size_t indent, std::ostream& stream
 	stream << std::string(indent+2, ' ') << "connections: " << c->connections().size() << std::endl;
 	stream << std::string(indent+2, ' ') << "parameters: " << c->parameters.size() << std::endl;
   if (not c->parameters.empty()) {
-    for (auto parameter: c->parameters) {
+    for (const auto& parameter: c->parameters) {
       YosysDebug::printParameter(parameter.first, parameter.second, 2, stream);
     }
   }
@@ -3,7 +3,11 @@
 
 #include "kernel/yosys.h"
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <sstream>
+#include <string>
 
 class YosysDebug {
   public:
@@ -19,4 +23,59 @@ class YosysDebug {
         size_t indent, std::ostream& stream = std::cerr);
 };
 
+//Export tracing (write_naja-if -trace <categories> -trace-filter <pattern>).
+//Off by default: a disabled trace point costs one relaxed atomic load,
+//its message is neither formatted nor written.
+//Enabled trace points are filtered by a Yosys pattern matched against
+//the module name or the traced object name, and written to stderr one
+//line at a time, from any thread.
+class YosysTrace {
+  public:
+    enum Category: uint32_t {
+      Modules     = 1 << 0, //interface of primitives and designs
+      Terms       = 1 << 1,
+      Parameters  = 1 << 2,
+      Nets        = 1 << 3,
+      Instances   = 1 << 4,
+      Components  = 1 << 5, //net bit components
+      All         = (1 << 6) - 1
+    };
+
+    //Enables categories with pattern (all names when empty) for its lifetime
+    class Scope {
+      public:
+        Scope(uint32_t categories, const std::string& pattern);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    //Parses a comma separated list of category names, or "all".
+    //Returns false on unknown names
+    static bool parseCategories(const std::string& text, uint32_t& categories);
+    static std::string getCategoryNames();
+
+    static bool isEnabled(Category category) {
+      return categories_.load(std::memory_order_relaxed) & category;
+    }
+    static bool matches(const char* moduleName, const char* name);
+    static void write(Category category, const std::string& message);
+
+  private:
+    static std::atomic<uint32_t>  categories_;
+    static std::string            pattern_;
+};
+
+//Writes the streamed message when category is enabled for moduleName or
+//name, which are only evaluated then.
+#define SNL_TRACE(category, moduleName, name, message) \
+  do { \
+    if (YosysTrace::isEnabled(YosysTrace::category) \
+      and YosysTrace::matches(moduleName, name)) { \
+      std::ostringstream traceStream; \
+      traceStream << message; \
+      YosysTrace::write(YosysTrace::category, traceStream.str()); \
+    } \
+  } while (0)
+
 #endif /* __YOSYS_DEBUG_H_ */
@@ -0,0 +1,595 @@
+#include "kernel/yosys.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef VOID
+#undef VOID
+#endif
+#include "naja_nl_interface.capnp.h"
+#include "naja_nl_implementation.capnp.h"
+#include "snl_reader.h"
+#include "yosys_parameter.h"
+
+USING_YOSYS_NAMESPACE
+PRIVATE_NAMESPACE_BEGIN
+
+using DesignImplementation = DBImplementation::LibraryImplementation::SNLDesignImplementation;
+
+RTLIL::IdString getId(const capnp::Text::Reader& name) {
+  return RTLIL::escape_id(name.cStr());
+}
+
+int getSize(int msb, int lsb) {
+  return std::abs(lsb - msb) + 1;
+}
+
+//Constant driven by a net of type, for ASSIGN and SUPPLY nets.
+//Returns false for standard nets.
+bool getConstant(DBImplementation::NetType type, RTLIL::State& state) {
+  switch (type) {
+    case DBImplementation::NetType::ASSIGN0:
+    case DBImplementation::NetType::SUPPLY0:
+      state = RTLIL::State::S0;
+      return true;
+    case DBImplementation::NetType::ASSIGN1:
+    case DBImplementation::NetType::SUPPLY1:
+      state = RTLIL::State::S1;
+      return true;
+    default:
+      return false;
+  }
+}
+
+//Imported SNL design. Instance connections of all the instances of a
+//module are gathered in one flat bit array: termBits_ gives the first
+//bit of each term of the model, bitsSize_ the bits of all its terms.
+struct ImportedDesign {
+  RTLIL::Module*            module_   {nullptr};
+  std::vector<RTLIL::Wire*> terms_    {};  //port wires indexed by term ID
+  std::vector<size_t>       termBits_ {};
+  size_t                    bitsSize_ {0};
+  //names of the parameters declared as STRING
+  pool<RTLIL::IdString>     stringParameters_ {};
+};
+//indexed by design ID
+using ImportedLibrary = std::vector<ImportedDesign>;
+//indexed by library ID
+using ImportedLibraries = std::vector<ImportedLibrary>;
+
+const ImportedDesign& getDesign(const ImportedLibraries& libraries, const DesignReference::Reader& reference) {
+  auto libraryID = reference.getLibraryID();
+  auto designID = reference.getDesignID();
+  if (libraryID >= libraries.size() or designID >= libraries[libraryID].size()
+    or not libraries[libraryID][designID].module_) {
+    log_error("Unknown design reference %u:%u\n", unsigned(libraryID), unsigned(designID));
+  }
+  return libraries[libraryID][designID];
+}
+
+RTLIL::Wire* createTerm(
+  RTLIL::Module* module,
+  const SNLDesignInterface::Term::Reader& term,
+  uint32_t& termID) {
+  RTLIL::Wire* wire = nullptr;
+  Direction direction;
+  if (term.isScalarTerm()) {
+    auto scalarTerm = term.getScalarTerm();
+    termID = scalarTerm.getId();
+    wire = module->addWire(getId(scalarTerm.getName()));
+    direction = scalarTerm.getDirection();
+  } else {
+    auto busTerm = term.getBusTerm();
+    termID = busTerm.getId();
+    auto msb = busTerm.getMsb();
+    auto lsb = busTerm.getLsb();
+    wire = module->addWire(getId(busTerm.getName()), getSize(msb, lsb));
+    wire->upto = msb < lsb;
+    wire->start_offset = std::min(msb, lsb);
+    direction = busTerm.getDirection();
+  }
+  wire->port_input = direction != Direction::OUTPUT;
+  wire->port_output = direction != Direction::INPUT;
+  wire->port_id = termID + 1;
+  return wire;
+}
+
+//Returns the term wire of an existing module, used when a primitive is
+//already defined in the design (for instance by a read liberty)
+RTLIL::Wire* findTerm(
+  RTLIL::Module* module,
+  const SNLDesignInterface::Term::Reader& term,
+  uint32_t& termID) {
+  RTLIL::IdString name;
+  if (term.isScalarTerm()) {
+    termID = term.getScalarTerm().getId();
+    name = getId(term.getScalarTerm().getName());
+  } else {
+    termID = term.getBusTerm().getId();
+    name = getId(term.getBusTerm().getName());
+  }
+  auto wire = module->wire(name);
+  if (not wire or wire->port_id == 0) {
+    log_error("Module %s has no port %s\n", log_id(module->name), log_id(name));
+  }
+  return wire;
+}
+
+void importDesignInterface(
+  RTLIL::Design* design,
+  const SNLDesignInterface::Reader& designInterface,
+  bool primitive,
+  ImportedDesign& imported) {
+  auto name = getId(designInterface.getName());
+  auto module = design->module(name);
+  bool existing = module != nullptr;
+  if (existing and not primitive) {
+    log_error("Re-definition of module %s\n", log_id(name));
+  }
+  if (not existing) {
+    module = design->addModule(name);
+    if (primitive) {
+      module->set_bool_attribute(ID::blackbox);
+      for (auto parameter: designInterface.getParameters()) {
+        auto parameterName = getId(parameter.getName());
+        module->avail_parameters.insert(parameterName);
+        std::string value = parameter.getValue();
+        if (not value.empty()) {
+          module->parameter_default_values[parameterName] =
+            YosysParameter::parse(value, parameter.getType());
+        }
+      }
+    }
+  }
+  imported.module_ = module;
+  //instance parameters have no type: their string values would be
+  //inferred as numbers when they look like one
+  for (auto parameter: designInterface.getParameters()) {
+    if (parameter.getType() == ParameterType::STRING and parameter.getValue().size() > 0) {
+      imported.stringParameters_.insert(getId(parameter.getName()));
+    }
+  }
+  auto terms = designInterface.getTerms();
+  imported.terms_.assign(terms.size(), nullptr);
+  for (auto term: terms) {
+    uint32_t termID = 0;
+    auto wire = existing ? findTerm(module, term, termID) : createTerm(module, term, termID);
+    if (termID >= terms.size() or imported.terms_[termID]) {
+      log_error("Invalid term ID %u in %s\n", termID, log_id(name));
+    }
+    imported.terms_[termID] = wire;
+  }
+  if (not existing) {
+    module->fixup_ports();
+  }
+  imported.termBits_.resize(terms.size());
+  imported.bitsSize_ = 0;
+  for (size_t termID = 0; termID < terms.size(); ++termID) {
+    imported.termBits_[termID] = imported.bitsSize_;
+    imported.bitsSize_ += imported.terms_[termID]->width;
+  }
+}
+
+void importInterface(
+  RTLIL::Design* design,
+  const DBInterface::Reader& db,
+  ImportedLibraries& libraries) {
+  for (auto library: db.getLibraryInterfaces()) {
+    auto libraryID = library.getId();
+    if (libraryID >= libraries.size()) {
+      libraries.resize(libraryID + 1);
+    }
+    bool primitives = library.getType() == DBInterface::LibraryType::PRIMITIVES;
+    auto designs = library.getSnlDesignInterfaces();
+    auto& imported = libraries[libraryID];
+    imported.resize(designs.size());
+    for (auto designInterface: designs) {
+      auto designID = designInterface.getId();
+      if (designID >= designs.size()) {
+        log_error("Invalid design ID %u in library %u\n", unsigned(designID), unsigned(libraryID));
+      }
+      importDesignInterface(design, designInterface, primitives, imported[designID]);
+    }
+  }
+  if (db.hasTopDesignReference()) {
+    getDesign(libraries, db.getTopDesignReference()).module_->set_bool_attribute(ID::top);
+  }
+}
+
+//Net wires of port nets are the port wires created from the interface.
+RTLIL::Wire* getNetWire(RTLIL::Module* module, const capnp::Text::Reader& name, int width) {
+  auto id = getId(name);
+  auto wire = module->wire(id);
+  if (wire) {
+    if (wire->width != width) {
+      log_error("Net %s of %s does not match its port width\n", log_id(id), log_id(module->name));
+    }
+    return wire;
+  }
+  return module->addWire(id, width);
+}
+
+void importDesignImplementation(
+  const DesignImplementation::Reader& implementation,
+  const ImportedDesign& imported,
+  const ImportedLibraries& libraries) {
+  auto module = imported.module_;
+  auto instances = implementation.getInstances();
+  size_t instancesSize = instances.size();
+  std::vector<RTLIL::Cell*> cells(instancesSize, nullptr);
+  std::vector<const ImportedDesign*> models(instancesSize, nullptr);
+  for (auto instance: instances) {
+    auto instanceID = instance.getId();
+    if (instanceID >= instancesSize or cells[instanceID]) {
+      log_error("Invalid instance ID %u in %s\n", unsigned(instanceID), log_id(module->name));
+    }
+    auto& model = getDesign(libraries, instance.getModelReference());
+    auto cell = module->addCell(getId(instance.getName()), model.module_->name);
+    for (auto instParameter: instance.getInstParameters()) {
+      std::string value = instParameter.getValue();
+      auto parameterName = getId(instParameter.getName());
+      auto type = model.stringParameters_.count(parameterName)
+        ? ParameterType::STRING : YosysParameter::getType(value);
+      cell->setParam(parameterName, YosysParameter::parse(value, type));
+    }
+    cells[instanceID] = cell;
+    models[instanceID] = &model;
+  }
+  //connection bits of all instances, filled from the net components
+  std::vector<size_t> firstBits(instancesSize + 1, 0);
+  for (size_t i = 0; i < instancesSize; ++i) {
+    firstBits[i+1] = firstBits[i] + models[i]->bitsSize_;
+  }
+  std::vector<RTLIL::SigBit> connections(firstBits.back());
+  std::vector<bool> connected(firstBits.back(), false);
+
+  auto connect = [&](const RTLIL::SigBit& netBit, const DBImplementation::NetComponentReference::Reader& component) {
+    if (component.isInstTermReference()) {
+      auto reference = component.getInstTermReference();
+      auto instanceID = reference.getInstanceID();
+      auto termID = reference.getTermID();
+      if (instanceID >= instancesSize or termID >= models[instanceID]->terms_.size()) {
+        log_error("Invalid instance term reference %u:%u in %s\n",
+          unsigned(instanceID), unsigned(termID), log_id(module->name));
+      }
+      auto model = models[instanceID];
+      auto term = model->terms_[termID];
+      int offset = (term->width == 1) ? 0 : term->from_hdl_index(reference.getBit());
+      if (offset < 0 or offset >= term->width) {
+        log_error("Invalid bit %d of %s in %s\n", reference.getBit(), log_id(term->name), log_id(module->name));
+      }
+      auto bit = firstBits[instanceID] + model->termBits_[termID] + offset;
+      connections[bit] = netBit;
+      connected[bit] = true;
+    } else {
+      auto reference = component.getTermReference();
+      auto termID = reference.getTermID();
+      if (termID >= imported.terms_.size()) {
+        log_error("Invalid term reference %u in %s\n", unsigned(termID), log_id(module->name));
+      }
+      auto term = imported.terms_[termID];
+      int offset = (term->width == 1) ? 0 : term->from_hdl_index(reference.getBit());
+      if (offset < 0 or offset >= term->width) {
+        log_error("Invalid bit %d of %s in %s\n", reference.getBit(), log_id(term->name), log_id(module->name));
+      }
+      RTLIL::SigBit termBit(term, offset);
+      if (termBit != netBit) {
+        module->connect(termBit, netBit);
+      }
+    }
+  };
+
+  for (auto net: implementation.getNets()) {
+    RTLIL::State constant;
+    if (net.isScalarNet() and getConstant(net.getScalarNet().getType(), constant)) {
+      //constant nets, such as the unnamed ones written for constant bits,
+      //connect their components to the constant
+      for (auto component: net.getScalarNet().getComponents()) {
+        connect(constant, component);
+      }
+      continue;
+    }
+    if (net.isScalarNet()) {
+      auto scalarNet = net.getScalarNet();
+      auto wire = getNetWire(module, scalarNet.getName(), 1);
+      for (auto component: scalarNet.getComponents()) {
+        connect(RTLIL::SigBit(wire, 0), component);
+      }
+    } else {
+      auto busNet = net.getBusNet();
+      auto msb = busNet.getMsb();
+      auto lsb = busNet.getLsb();
+      auto wire = getNetWire(module, busNet.getName(), getSize(msb, lsb));
+      wire->upto = msb < lsb;
+      wire->start_offset = std::min(msb, lsb);
+      for (auto bit: busNet.getBits()) {
+        int offset = wire->from_hdl_index(bit.getBit());
+        if (offset < 0 or offset >= wire->width) {
+          log_error("Invalid bit %d of %s in %s\n", bit.getBit(), log_id(wire->name), log_id(module->name));
+        }
+        for (auto component: bit.getComponents()) {
+          connect(RTLIL::SigBit(wire, offset), component);
+        }
+        if (getConstant(bit.getType(), constant)) {
+          module->connect(RTLIL::SigBit(wire, offset), constant);
+        }
+      }
+    }
+  }
+
+  //one setPort per connected term, unconnected bits of a connected term are x
+  for (size_t i = 0; i < instancesSize; ++i) {
+    auto model = models[i];
+    for (size_t termID = 0; termID < model->terms_.size(); ++termID) {
+      auto term = model->terms_[termID];
+      auto first = firstBits[i] + model->termBits_[termID];
+      auto last = first + term->width;
+      if (std::find(connected.begin() + first, connected.begin() + last, true) == connected.begin() + last) {
+        continue;
+      }
+      std::vector<RTLIL::SigBit> bits(connections.begin() + first, connections.begin() + last);
+      for (size_t bit = first; bit < last; ++bit) {
+        if (not connected[bit]) {
+          bits[bit - first] = RTLIL::State::Sx;
+        }
+      }
+      cells[i]->setPort(term->name, RTLIL::SigSpec(bits));
+    }
+  }
+}
+
+//Imports the implementations of db, only the one of selected when set
+void importImplementation(
+  const DBImplementation::Reader& db,
+  const ImportedLibraries& libraries,
+  const ImportedDesign* selected = nullptr) {
+  for (auto library: db.getLibraryImplementations()) {
+    auto libraryID = library.getId();
+    for (auto implementation: library.getSnlDesignImplementations()) {
+      auto designID = implementation.getId();
+      if (libraryID >= libraries.size() or designID >= libraries[libraryID].size()) {
+        log_error("Implementation of unknown design %u:%u\n", unsigned(libraryID), unsigned(designID));
+      }
+      const auto& imported = libraries[libraryID][designID];
+      if (selected and &imported != selected) {
+        continue;
+      }
+      importDesignImplementation(implementation, imported, libraries);
+    }
+  }
+}
+
+//Imports the implementations of a -index export from their messages
+//listed in db_designs.idx: each one is mapped and decoded on its own.
+void importIndexedImplementation(
+  const std::filesystem::path& dir,
+  const SNLManifest& manifest,
+  unsigned jobs,
+  const ImportedLibraries& libraries,
+  const ImportedDesign* selected) {
+  auto index = SNLDesignsIndex::read(dir);
+  for (const auto& entry: index.entries_) {
+    if (entry.libraryID_ >= libraries.size() or entry.designID_ >= libraries[entry.libraryID_].size()) {
+      log_error("Implementation of unknown design %u:%u\n", entry.libraryID_, entry.designID_);
+    }
+    const auto& imported = libraries[entry.libraryID_][entry.designID_];
+    if (selected and &imported != selected) {
+      continue;
+    }
+    if (selected) {
+      log("Importing %s: %zu instances, %zu nets.\n",
+        log_id(imported.module_->name), entry.instances_, entry.nets_);
+    }
+    SNLMessage message(dir/entry.fileName_, entry.offset_, entry.length_, manifest, jobs);
+    importImplementation(message.getRoot<DBImplementation>(), libraries, &imported);
+  }
+}
+
+//Returns the user design named name, of which -design imports the
+//implementation. The other user designs are left as blackboxes.
+const ImportedDesign* selectDesign(const std::string& name, const ImportedLibraries& libraries) {
+  auto id = RTLIL::escape_id(name);
+  const ImportedDesign* selected = nullptr;
+  for (const auto& library: libraries) {
+    for (const auto& imported: library) {
+      if (imported.module_ and imported.module_->name == id
+        and not imported.module_->get_blackbox_attribute()) {
+        selected = &imported;
+      }
+    }
+  }
+  if (not selected) {
+    log_error("Cannot find design %s.\n", name.c_str());
+  }
+  for (const auto& library: libraries) {
+    for (const auto& imported: library) {
+      if (imported.module_ and &imported != selected
+        and not imported.module_->get_blackbox_attribute()) {
+        imported.module_->set_bool_attribute(ID::blackbox);
+      }
+    }
+  }
+  return selected;
+}
+
+//db_implementation.snl, or the files listed in db_implementation.idx
+//when the export was split
+std::vector<std::filesystem::path> getImplementationPaths(const std::filesystem::path& dir) {
+  std::vector<std::filesystem::path> paths;
+  std::ifstream index(dir/"db_implementation.idx");
+  if (not index) {
+    paths.push_back(dir/"db_implementation.snl");
+    return paths;
+  }
+  std::string line;
+  while (std::getline(index, line)) {
+    std::istringstream fields(line);
+    std::string fileName;
+    if (fields >> fileName) {
+      paths.push_back(dir/fileName);
+    }
+  }
+  return paths;
+}
+
+size_t getDesignsSize(const ImportedLibraries& libraries) {
+  size_t designs = 0;
+  for (const auto& library: libraries) {
+    designs += library.size();
+  }
+  return designs;
+}
+
+//Imports the items of a stream as they arrive: the manifest, the
+//interface then the implementation files.
+void importStream(
+  RTLIL::Design* design,
+  const std::string& source,
+  unsigned jobs,
+  ImportedLibraries& libraries) {
+  SNLStreamReader stream(source);
+  std::string name;
+  std::vector<uint8_t> bytes;
+  if (not stream.next(name, bytes) or name != "snl.mf") {
+    throw std::runtime_error("SNL stream does not start with snl.mf: " + source);
+  }
+  std::istringstream manifestStream(std::string(bytes.begin(), bytes.end()));
+  auto manifest = SNLManifest::parse(manifestStream, name);
+  bool interfaceImported = false;
+  while (stream.next(name, bytes)) {
+    if (name == "db_interface.snl") {
+      SNLMessage message(std::move(bytes), name, manifest, jobs);
+      importInterface(design, message.getRoot<DBInterface>(), libraries);
+      interfaceImported = true;
+    } else if (name.compare(0, 17, "db_implementation") == 0
+      and name.size() > 4 and name.compare(name.size() - 4, 4, ".snl") == 0) {
+      if (not interfaceImported) {
+        throw std::runtime_error("SNL stream implementation before interface: " + name);
+      }
+      SNLMessage message(std::move(bytes), name, manifest, jobs);
+      importImplementation(message.getRoot<DBImplementation>(), libraries);
+    }
+    //other items, such as db_implementation.idx, are not needed
+    bytes = std::vector<uint8_t>();
+  }
+}
+
+struct SNLFrontend: public Frontend {
+  SNLFrontend() : Frontend("naja-if", "read design from Naja SNL netlist files") {}
+	void execute(std::istream *&f, std::string filename, std::vector<std::string> args, RTLIL::Design *design) override {
+    log_header(design, "Executing Naja SNL frontend.\n");
+
+    unsigned jobs = 1;
+    std::string streamSource;
+    std::string designName;
+    size_t argidx;
+    for (argidx = 1; argidx < args.size(); argidx++) {
+      if (args[argidx] == "-j" && argidx+1 < args.size()) {
+        int value = atoi(args[++argidx].c_str());
+        if (value < 0) {
+          log_cmd_error("Invalid number of jobs: %d\n", value);
+        }
+        jobs = (value == 0) ? std::max(1u, std::thread::hardware_concurrency()) : value;
+        continue;
+      }
+      if (args[argidx] == "-stream" && argidx+1 < args.size()) {
+        streamSource = args[++argidx];
+        continue;
+      }
+      if (args[argidx] == "-design" && argidx+1 < args.size()) {
+        designName = args[++argidx];
+        continue;
+      }
+      break;
+    }
+    std::filesystem::path dir("snl");
+    if (argidx < args.size()) {
+      dir = args[argidx++];
+    }
+    if (argidx < args.size()) {
+      cmd_error(args, argidx, "Unknown option or extra argument.");
+    }
+
+    if (not streamSource.empty() and not designName.empty()) {
+      log_cmd_error("-design cannot be combined with -stream.\n");
+    }
+
+    ImportedLibraries libraries;
+    try {
+      if (not streamSource.empty()) {
+        importStream(design, streamSource, jobs, libraries);
+        log("Imported %zu designs from %s.\n", getDesignsSize(libraries), streamSource.c_str());
+        return;
+      }
+      auto manifest = SNLManifest::read(dir);
+      {
+        SNLMessage message(dir/"db_interface.snl", manifest, jobs);
+        importInterface(design, message.getRoot<DBInterface>(), libraries);
+      }
+      const ImportedDesign* selected = nullptr;
+      if (not designName.empty()) {
+        selected = selectDesign(designName, libraries);
+      }
+      if (manifest.indexed_) {
+        importIndexedImplementation(dir, manifest, jobs, libraries, selected);
+      } else {
+        for (const auto& path: getImplementationPaths(dir)) {
+          //one implementation file in memory at a time
+          SNLMessage message(path, manifest, jobs);
+          importImplementation(message.getRoot<DBImplementation>(), libraries, selected);
+        }
+      }
+    } catch (const std::exception& e) {
+      //capnp traversal is lazy: malformed messages throw kj exceptions
+      //while they are imported, after SNLMessage has been constructed
+      log_error("%s\n", e.what());
+    }
+    log("Imported %zu designs from %s.\n", getDesignsSize(libraries), dir.c_str());
+  }
+
+	void help() override
+	{
+		log("\n");
+		log("    read_naja-if [options] [<dir>]\n");
+		log("\n");
+		log("Read a design written by write_naja-if from the <dir> directory\n");
+		log("(default: snl). Primitives already defined in the design are used\n");
+		log("as is, other primitives are created as blackboxes.\n");
+		log("Unpacked and uncompressed files are mapped and read in place.\n");
+		log("\n");
+		log("Instance parameter values are untyped in the format. They are read as\n");
+		log("strings when the parameter of the primitive is a string, otherwise\n");
+		log("their type follows their text: a string parameter of an instance of\n");
+		log("a user design whose value reads as a number, for instance \"5\", comes\n");
+		log("back as a bit vector.\n");
+		log("\n");
+		log("The primitives generated by write_naja-if for Yosys internal cells\n");
+		log("(yosys_add_A_8s_B_8s_Y_9...) are read as blackboxes: their instances\n");
+		log("are not mapped back to internal cells.\n");
+		log("\n");
+		log("    -j <N>\n");
+		log("        decompress compressed files on N threads (0: one per core).\n");
+		log("\n");
+		log("    -stream <source>\n");
+		log("        read the stream of write_naja-if -stream instead of a directory,\n");
+		log("        importing each file as it arrives. source is fd:<N> for an\n");
+		log("        inherited file descriptor, the path of a FIFO or of a file, or\n");
+		log("        otherwise the path of a Unix domain socket that is created and\n");
+		log("        waits for write_naja-if to connect.\n");
+		log("\n");
+		log("    -design <name>\n");
+		log("        import the interfaces of all the designs but the implementation\n");
+		log("        of design name only, the other designs are left as blackboxes.\n");
+		log("        With an export written with write_naja-if -index, only the\n");
+		log("        message of this design is mapped and decoded, located by\n");
+		log("        db_designs.idx; otherwise the implementation files are decoded\n");
+		log("        in full.\n");
+		log("\n");
+	}
+
+} SNLFrontend;
+
+PRIVATE_NAMESPACE_END
@@ -0,0 +1,91 @@
+#include "yosys_hash.h"
+
+#include <cstring>
+
+USING_YOSYS_NAMESPACE
+
+namespace {
+
+//splitmix64 finalizer
+uint64_t mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111eb;
+  x ^= x >> 31;
+  return x;
+}
+
+}
+
+void YosysHash::add(uint64_t value) {
+  //two lanes combined differently so that the 128 bits are independent
+  h1_ = mix(h1_ ^ value);
+  h2_ = mix(h2_ + value * 0x9e3779b97f4a7c15 + 1);
+}
+
+void YosysHash::addString(const char* data, size_t size) {
+  add(size);
+  for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(uint64_t));
+    add(word);
+  }
+  if (size > 0) {
+    uint64_t word = 0;
+    std::memcpy(&word, data, size);
+    add(word);
+  }
+}
+
+void YosysHash::addString(const std::string& s) {
+  addString(s.data(), s.size());
+}
+
+void YosysHash::addId(const RTLIL::IdString& id) {
+  auto name = id.c_str();
+  addString(name, std::strlen(name));
+}
+
+void YosysHash::addConst(const RTLIL::Const& value) {
+  add(value.flags);
+  add(value.size());
+  for (int i = 0; i < value.size(); ++i) {
+    add(value[i]);
+  }
+}
+
+void YosysHash::addSig(const RTLIL::SigSpec& sig) {
+  add(sig.size());
+  for (const auto& chunk: sig.chunks()) {
+    if (chunk.wire) {
+      add(1);
+      addId(chunk.wire->name);
+      add(chunk.offset);
+      add(chunk.width);
+    } else {
+      add(0);
+      add(chunk.width);
+      for (auto state: chunk.data) {
+        add(state);
+      }
+    }
+  }
+}
+
+void YosysHash::addWire(const RTLIL::Wire* wire) {
+  addId(wire->name);
+  add(wire->width);
+  add(wire->start_offset);
+  add(wire->upto);
+  add(wire->port_id);
+  add(wire->port_input);
+  add(wire->port_output);
+}
+
+YosysHash::Key YosysHash::getKey() const {
+  char key[33];
+  snprintf(key, sizeof(key), "%016llx%016llx",
+    (unsigned long long)h1_, (unsigned long long)h2_);
+  return key;
+}
@@ -0,0 +1,35 @@
+#ifndef __YOSYS_HASH_H_
+#define __YOSYS_HASH_H_
+
+#include "kernel/yosys.h"
+
+#include <cstdint>
+#include <string>
+
+//128 bit content hash of RTLIL objects, used as the key of cached
+//export fragments (see snl_cache.h).
+//Objects are hashed by value: names instead of pointers, so keys are
+//stable across Yosys runs. Only reads RTLIL and never creates IdStrings,
+//so it can be used on worker threads.
+class YosysHash {
+  public:
+    using Key = std::string;
+
+    void add(uint64_t value);
+    void addString(const char* data, size_t size);
+    void addString(const std::string& s);
+    void addId(const Yosys::RTLIL::IdString& id);
+    void addConst(const Yosys::RTLIL::Const& value);
+    void addSig(const Yosys::RTLIL::SigSpec& sig);
+    //name, width, bit numbering and port attributes
+    void addWire(const Yosys::RTLIL::Wire* wire);
+
+    //32 hexadecimal digits
+    Key getKey() const;
+
+  private:
+    uint64_t  h1_ {0x243f6a8885a308d3};
+    uint64_t  h2_ {0x13198a2e03707344};
+};
+
+#endif /* __YOSYS_HASH_H_ */
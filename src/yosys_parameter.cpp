@@ -0,0 +1,175 @@
+#include "yosys_parameter.h"
+
+USING_YOSYS_NAMESPACE
+
+namespace {
+
+//Decimal integer of any size
+bool isInteger(const std::string& text) {
+  size_t position = (not text.empty() and text[0] == '-') ? 1 : 0;
+  return position < text.size()
+    and text.find_first_not_of("0123456789", position) == std::string::npos;
+}
+
+//Signed constant of an integer: 32 bits when the value fits in an int,
+//as Verilog integer parameters, else the bits it needs plus the sign.
+RTLIL::Const parseInteger(const std::string& text) {
+  bool isNegative = text[0] == '-';
+  std::string digits = text.substr(isNegative ? 1 : 0);
+  if (digits.size() <= 10) {
+    auto value = std::stoll(text);
+    if (value >= INT32_MIN and value <= INT32_MAX) {
+      RTLIL::Const constant(int(value), 32);
+      constant.flags |= RTLIL::CONST_FLAG_SIGNED;
+      return constant;
+    }
+  }
+  //magnitude bits, lsb first, by repeated division by 2
+  std::vector<RTLIL::State> bits;
+  size_t first = digits.find_first_not_of('0');
+  while (first != std::string::npos) {
+    int remainder = 0;
+    for (size_t i = first; i < digits.size(); ++i) {
+      int current = remainder * 10 + (digits[i] - '0');
+      digits[i] = char('0' + current / 2);
+      remainder = current % 2;
+    }
+    bits.push_back(remainder ? RTLIL::State::S1 : RTLIL::State::S0);
+    first = digits.find_first_not_of('0', first);
+  }
+  bits.push_back(RTLIL::State::S0);
+  if (isNegative) {
+    //two's complement: invert the bits above the lowest set bit
+    bool invert = false;
+    for (auto& bit: bits) {
+      if (invert) {
+        bit = (bit == RTLIL::State::S1) ? RTLIL::State::S0 : RTLIL::State::S1;
+      } else if (bit == RTLIL::State::S1) {
+        invert = true;
+      }
+    }
+  }
+  RTLIL::Const constant(bits);
+  constant.flags |= RTLIL::CONST_FLAG_SIGNED;
+  return constant;
+}
+
+RTLIL::State getState(char c) {
+  switch (c) {
+    case '0': return RTLIL::State::S0;
+    case '1': return RTLIL::State::S1;
+    case 'z': return RTLIL::State::Sz;
+    case '-': return RTLIL::State::Sa;
+    case 'm': return RTLIL::State::Sm;
+    default: return RTLIL::State::Sx;
+  }
+}
+
+int getDigit(char c) {
+  if (c >= '0' and c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' and c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' and c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+}
+
+std::string YosysParameter::format(const RTLIL::Const& value, ParameterType& type) {
+  if (value.flags & (RTLIL::CONST_FLAG_STRING | RTLIL::CONST_FLAG_REAL)) {
+    type = (value.flags & RTLIL::CONST_FLAG_REAL) ? ParameterType::DECIMAL : ParameterType::STRING;
+    return value.decode_string();
+  }
+  bool isSigned = value.flags & RTLIL::CONST_FLAG_SIGNED;
+  int size = value.size();
+  bool isDefined = value.is_fully_def();
+  if (isSigned and size == 32 and isDefined) {
+    type = ParameterType::DECIMAL;
+    return std::to_string(value.as_int(true));
+  }
+  type = ParameterType::BINARY;
+  std::string text = std::to_string(size) + (isSigned ? "'s" : "'");
+  if (not isDefined) {
+    //as_string is msb first
+    return text + 'b' + value.as_string();
+  }
+  text += 'h';
+  static constexpr char Digits[] = "0123456789abcdef";
+  for (int nibble = (size + 3) / 4 - 1; nibble >= 0; --nibble) {
+    int digit = 0;
+    for (int i = 3; i >= 0; --i) {
+      int bit = nibble*4 + i;
+      digit = (digit << 1) | ((bit < size and value[bit] == RTLIL::State::S1) ? 1 : 0);
+    }
+    text += Digits[digit];
+  }
+  return text;
+}
+
+ParameterType YosysParameter::getType(const std::string& text) {
+  if (isInteger(text)) {
+    return ParameterType::DECIMAL;
+  }
+  auto quote = text.find('\'');
+  if (quote != std::string::npos and quote > 0
+    and text.find_first_not_of("0123456789") == quote) {
+    return ParameterType::BINARY;
+  }
+  return ParameterType::STRING;
+}
+
+RTLIL::Const YosysParameter::parse(const std::string& text, ParameterType type) {
+  if (type == ParameterType::DECIMAL) {
+    if (isInteger(text)) {
+      return parseInteger(text);
+    }
+    RTLIL::Const value(text);
+    value.flags |= RTLIL::CONST_FLAG_REAL;
+    return value;
+  }
+  if (type == ParameterType::BOOLEAN) {
+    return RTLIL::Const(text == "1" or text == "true" ? 1 : 0, 1);
+  }
+  auto quote = text.find('\'');
+  if (type != ParameterType::BINARY or quote == std::string::npos or quote + 1 >= text.size()) {
+    return RTLIL::Const(text);
+  }
+  auto sizeText = text.substr(0, quote);
+  if (sizeText.empty() or sizeText.size() > 9
+    or sizeText.find_first_not_of("0123456789") != std::string::npos) {
+    return RTLIL::Const(text);
+  }
+  int size = std::stoi(sizeText);
+  size_t position = quote + 1;
+  bool isSigned = text[position] == 's';
+  if (isSigned) {
+    ++position;
+  }
+  char base = (position < text.size()) ? text[position++] : 'b';
+  std::vector<RTLIL::State> bits;
+  bits.reserve(size);
+  //digits are msb first
+  for (size_t i = text.size(); i > position and (int)bits.size() < size; --i) {
+    char c = text[i-1];
+    if (base == 'h') {
+      int digit = getDigit(c);
+      for (int bit = 0; bit < 4; ++bit) {
+        bits.push_back(digit < 0 ? RTLIL::State::Sx
+          : ((digit >> bit) & 1) ? RTLIL::State::S1 : RTLIL::State::S0);
+      }
+    } else {
+      bits.push_back(getState(c));
+    }
+  }
+  bits.resize(size, RTLIL::State::S0);
+  RTLIL::Const value(bits);
+  if (isSigned) {
+    value.flags |= RTLIL::CONST_FLAG_SIGNED;
+  }
+  return value;
+}
@@ -0,0 +1,29 @@
+#ifndef __YOSYS_PARAMETER_H_
+#define __YOSYS_PARAMETER_H_
+
+#include "kernel/yosys.h"
+
+#ifdef VOID
+#undef VOID
+#endif
+#include "naja_common.capnp.h"
+
+//Text encoding of RTLIL parameter values in SNL parameters:
+//  STRING:  the string itself
+//  DECIMAL: 32 bit signed integers (Verilog integer parameters) and reals.
+//           Larger integers are parsed as signed constants of their size.
+//  BINARY:  other bit vectors as sized Verilog constants, in hexadecimal
+//           when all bits are defined (<size>'h..., <size>'sh... when
+//           signed), in binary otherwise (<size>'b01xz...)
+//Hexadecimal keeps large INIT values four times smaller than as_string().
+class YosysParameter {
+  public:
+    static std::string format(const Yosys::RTLIL::Const& value, ParameterType& type);
+    static Yosys::RTLIL::Const parse(const std::string& text, ParameterType type);
+    //Type of a formatted value, for values stored without type.
+    //Strings that look like numbers come back as DECIMAL or BINARY:
+    //prefer the declared type when there is one.
+    static ParameterType getType(const std::string& text);
+};
+
+#endif /* __YOSYS_PARAMETER_H_ */
@@ -2,29 +2,44 @@
 #include "kernel/sigtools.h"
 
 #include <filesystem>
-#include <fcntl.h>
-#include <unistd.h>
+#include <algorithm>
 #include <cassert>
+#include <deque>
+#include <limits>
+#include <numeric>
+#include <sstream>
 
 #ifdef VOID
 #undef VOID
 #endif
 #include <capnp/message.h>
+#include <capnp/serialize.h>
 #include <capnp/serialize-packed.h>
 
 #include "naja_nl_interface.capnp.h"
 #include "naja_nl_implementation.capnp.h"
 #include "yosys_debug.h"
-
-#define SNL_YOSYS_PLUGIN_DEBUG 1
+#include "snl_parallel.h"
+#include "snl_stats.h"
+#include "snl_cache.h"
+#include "snl_order.h"
+#include "snl_reader.h"
+#include "snl_writer.h"
+#include "yosys_cell_primitives.h"
+#include "yosys_hash.h"
+#include "yosys_parameter.h"
+#ifdef SNL_WITH_ZSTD
+#include "snl_frames.h"
+#endif
 
 USING_YOSYS_NAMESPACE
 PRIVATE_NAMESPACE_BEGIN
 
 //namespace {
 
+//Does not copy yosysName: IdString copies are not thread safe
 std::string getName(const RTLIL::IdString& yosysName) {
-  return RTLIL::unescape_id(yosysName);
+  return RTLIL::unescape_id(yosysName.str());
 }
 
 Direction YosysToCapnPDirection(const RTLIL::Wire* wire) {
@@ -41,51 +56,303 @@ int getSize(int msb, int lsb) {
   return std::abs(lsb - msb) + 1;
 }
 
+//HDL bit number of the bit at Yosys offset (lsb first) in wire
+int getHDLBit(const RTLIL::Wire* wire, int offset) {
+  return wire->start_offset + ((wire->upto) ? wire->width - 1 - offset : offset);
+}
+
+//Net bit component: a term of the design (instanceID_ == DesignTerm)
+//or a term of an instance. bit_ is NoBit for scalar terms.
 struct Component {
-  int instanceID_ = 0;
-  bool isTerm_ = false;
-  bool isBus_ = false;
-  int termID_ = 0;
-  int bit_ = 0;
-  Component(int termID, bool isBus, int bit): isTerm_(true), isBus_(isBus), termID_(termID), bit_(bit) {}
-  Component(int instanceID, int termID, bool isBus, int bit): instanceID_(instanceID), isBus_(isBus), termID_(termID), bit_(bit) {}
+  static constexpr int DesignTerm = -1;
+  static constexpr int NoBit = std::numeric_limits<int>::min();
+  int instanceID_ {DesignTerm};
+  int termID_     {0};
+  int bit_        {NoBit};
+  bool isTerm() const { return instanceID_ == DesignTerm; }
+  bool isBus() const { return bit_ != NoBit; }
 };
 
-struct Bit {
-  using Components = std::vector<Component>;
-  Bit() = default;
-
-  Components  components_ {};
-  int         bit_        {0};
+//One net per wire. Net bits are the module flat bits
+//[firstBit_, firstBit_ + width) in Yosys offset order (lsb first).
+struct Net {
+  RTLIL::Wire*  wire_     {nullptr};
+  bool          isBus_    {false};
+  int           msb_      {0};
+  int           lsb_      {0};
+  size_t        firstBit_ {0};
+  Net(RTLIL::Wire* wire, size_t firstBit): wire_(wire), firstBit_(firstBit) {}
+  Net(RTLIL::Wire* wire, size_t firstBit, int msb, int lsb):
+    wire_(wire), isBus_(true), msb_(msb), lsb_(lsb), firstBit_(firstBit) {}
 };
 
-struct Net {
-  using Bits = std::vector<Bit>;
-  bool  isBus_  {false};
-  int msb_ {0};
-  int lsb_ {0};
-  Bits  bits_   {};
-  Net(): bits_(1) {}
-  Net(int msb, int lsb): isBus_(true), msb_(msb), lsb_(lsb), bits_(getSize(msb, lsb)) {
-    int incr = (msb<lsb)?+1:-1;
-    int i=0;
-    for (auto& bit: bits_) {
-      bit.bit_ = msb_ + i*incr; 
-      ++i;
+using Nets = std::vector<Net>;
+
+//Deterministic choice of the representative bit of an electrical node:
+//port bits first, then bits of public wires, then by name and offset.
+bool isPreferredAlias(const RTLIL::SigBit& bit, const RTLIL::SigBit& other) {
+  bool isPort = bit.wire->port_id != 0;
+  if (isPort != (other.wire->port_id != 0)) {
+    return isPort;
+  }
+  bool isPublic = bit.wire->name.isPublic();
+  if (isPublic != other.wire->name.isPublic()) {
+    return isPublic;
+  }
+  int order = strcmp(bit.wire->name.c_str(), other.wire->name.c_str());
+  if (order != 0) {
+    return order < 0;
+  }
+  return bit.offset < other.offset;
+}
+
+//Flat bits of the two nets shared by the constant bits of a module,
+//logic-0 and logic-1, numbered after its wire bits. x and z bits are
+//left unconnected, or tied to tieXZ_ (-tie-xz).
+struct ConstantBits {
+  size_t        const0_ {0};
+  size_t        const1_ {0};
+  RTLIL::State  tieXZ_  {RTLIL::State::Sx};
+  //Returns false if state is left unconnected
+  bool get(RTLIL::State state, size_t& bit) const {
+    if (state == RTLIL::State::Sx or state == RTLIL::State::Sz) {
+      state = tieXZ_;
+    }
+    if (state == RTLIL::State::S0) {
+      bit = const0_;
+      return true;
     }
+    if (state == RTLIL::State::S1) {
+      bit = const1_;
+      return true;
+    }
+    return false;
   }
 };
 
-using Nets = std::map<const RTLIL::Wire*, Net>;
-using Terms = std::map<int, int>; //port_id, termid
+//Dense (wire, offset) -> net flat bit index of a module.
+//Bits of each wire are numbered contiguously in Yosys offset order,
+//so a SigSpec chunk costs one wire lookup and its bits are then
+//resolved by direct indexing.
+//Once aliases are merged, every bit resolves to the representative
+//bit of its electrical node, which carries all the node components.
+class NetBitIndex {
+  public:
+    void addWire(RTLIL::Wire* wire, size_t firstBit) {
+      firstBits_[wire] = firstBit;
+    }
+    //Returns the flat bit of wire at offset 0
+    size_t getFirstBit(RTLIL::Wire* wire) const {
+      auto it = firstBits_.find(wire);
+      assert(it != firstBits_.end());
+      return it->second;
+    }
+    //Groups the bits aliased by the module connections. Bits assigned a
+    //constant resolve to the constant bit.
+    //Only the bits of the connections are looked up, modules without
+    //connections cost nothing.
+    void mergeAliases(RTLIL::Module* module, size_t bitsSize, const ConstantBits& constantBits) {
+      if (module->connections().empty()) {
+        return;
+      }
+      SigMap sigmap(module);
+      //node -> representative bit
+      dict<RTLIL::SigBit, RTLIL::SigBit> nodes;
+      auto visitAliasedBits = [&](auto&& visit) {
+        for (const auto& connection: module->connections()) {
+          for (const auto* side: {&connection.first, &connection.second}) {
+            for (const auto& chunk: side->chunks()) {
+              if (not chunk.wire) {
+                continue;
+              }
+              for (int i = 0; i < chunk.width; ++i) {
+                RTLIL::SigBit bit(chunk.wire, chunk.offset + i);
+                visit(bit, sigmap(bit));
+              }
+            }
+          }
+        }
+      };
+      visitAliasedBits([&](const RTLIL::SigBit& bit, const RTLIL::SigBit& node) {
+        if (not node.wire) {
+          return;
+        }
+        auto it = nodes.find(node);
+        if (it == nodes.end()) {
+          nodes[node] = bit;
+        } else if (isPreferredAlias(bit, it->second)) {
+          it->second = bit;
+        }
+      });
+      representatives_.resize(bitsSize);
+      for (size_t bit = 0; bit < bitsSize; ++bit) {
+        representatives_[bit] = bit;
+      }
+      visitAliasedBits([&](const RTLIL::SigBit& bit, const RTLIL::SigBit& node) {
+        auto& representative = representatives_[getFirstBit(bit.wire) + bit.offset];
+        if (node.wire) {
+          const auto& nodeRepresentative = nodes.at(node);
+          representative = getFirstBit(nodeRepresentative.wire) + nodeRepresentative.offset;
+        } else {
+          //stays its own representative when left unconnected
+          constantBits.get(node.data, representative);
+        }
+      });
+    }
+    size_t resolve(size_t bit) const {
+      return representatives_.empty() ? bit : representatives_[bit];
+    }
+    bool isRepresentative(size_t bit) const {
+      return resolve(bit) == bit;
+    }
+  private:
+    dict<RTLIL::Wire*, size_t>  firstBits_        {};
+    //empty when no bits are aliased
+    std::vector<size_t>         representatives_  {};
+};
+
+//Components of all the net bits of a module, stored in CSR form.
+//Components are first counted per bit, then filled in one flat array,
+//so each bit component list is known with its exact size and no per bit
+//allocation is needed.
+class Connectivity {
+  public:
+    Connectivity(size_t bitsSize): offsets_(bitsSize + 1, 0) {}
+    //first pass
+    void count(size_t bit) {
+      ++offsets_[bit + 1];
+    }
+    //between passes: offsets_[bit+1] becomes the fill cursor of bit
+    void allocate() {
+      size_t size = 0;
+      for (size_t bit = 0; bit + 1 < offsets_.size(); ++bit) {
+        auto count = offsets_[bit + 1];
+        offsets_[bit + 1] = size;
+        size += count;
+      }
+      components_.resize(size);
+    }
+    //second pass, once filled offsets_[bit+1] is the end of bit
+    void add(size_t bit, const Component& component) {
+      components_[offsets_[bit + 1]++] = component;
+    }
+    const Component* begin(size_t bit) const {
+      return components_.data() + offsets_[bit];
+    }
+    const Component* end(size_t bit) const {
+      return components_.data() + offsets_[bit + 1];
+    }
+    size_t getFanout(size_t bit) const {
+      return offsets_[bit + 1] - offsets_[bit];
+    }
+    size_t getMaxFanout() const {
+      size_t maxFanout = 0;
+      for (size_t bit = 0; bit + 1 < offsets_.size(); ++bit) {
+        maxFanout = std::max(maxFanout, getFanout(bit));
+      }
+      return maxFanout;
+    }
+    size_t getComponentsSize() const {
+      return components_.size();
+    }
+  private:
+    std::vector<size_t>     offsets_    {};
+    std::vector<Component>  components_ {};
+};
+
+using Terms = std::vector<int>; //term ID indexed by port_id
+
+//Model port as seen from instances: term ID and bit numbering.
+//Models of a primitives library have no RTLIL module, so ports do not
+//refer to wires.
+struct Port {
+  int   termID_       {0};
+  int   width_        {1};
+  int   startOffset_  {0};
+  bool  upto_         {false};
+};
+
+//HDL bit number of the bit at Yosys offset (lsb first) in port
+int getHDLBit(const Port& port, int offset) {
+  return port.startOffset_ + ((port.upto_) ? port.width_ - 1 - offset : offset);
+}
 
 struct Model {
-  int   libraryID_  {0};
-  int   designID_   {0};
-  Terms terms_      {};
-  Model(int libraryID, int designID): libraryID_(libraryID), designID_(designID) {}
+  int                         libraryID_  {0};
+  int                         designID_   {0};
+  //term IDs of the module ports, for the module own implementation
+  Terms                       terms_      {};
+  dict<RTLIL::IdString, Port> ports_      {};
+  Model(int libraryID, int designID):
+    libraryID_(libraryID), designID_(designID) {}
+  //Returns the model port connected through port of an instance
+  const Port* getPort(const RTLIL::IdString& port) const {
+    auto it = ports_.find(port);
+    if (it == ports_.end()) {
+      return nullptr;
+    }
+    return &it->second;
+  }
+  int getTermID(const RTLIL::Wire* port) const {
+    assert(port->port_id > 0 and port->port_id < (int)terms_.size());
+    return terms_[port->port_id];
+  }
+};
+
+//Models interned by Yosys module name: resolving a cell type is one hash
+//lookup on its IdString, with no unescaping nor string allocation.
+class Models {
+  public:
+    //Returns nullptr if name is already registered
+    Model* add(const RTLIL::IdString& name, const Model& model) {
+      if (index_.count(name)) {
+        return nullptr;
+      }
+      index_[name] = models_.size();
+      models_.push_back(model);
+      return &models_.back();
+    }
+    const Model* find(const RTLIL::IdString& name) const {
+      auto it = index_.find(name);
+      if (it == index_.end()) {
+        return nullptr;
+      }
+      return &models_[it->second];
+    }
+    //Model of an instance: the model of its type, or the primitive of the
+    //variant of an internal cell (see YosysCellPrimitives)
+    const Model* find(const RTLIL::Cell* cell) const {
+      if (auto model = find(cell->type)) {
+        return model;
+      }
+      auto it = cells_.find(cell);
+      if (it == cells_.end()) {
+        return nullptr;
+      }
+      return &models_[it->second];
+    }
+    //Instances of cell use the model named name
+    void addCell(const RTLIL::Cell* cell, const RTLIL::IdString& name) {
+      auto it = index_.find(name);
+      assert(it != index_.end());
+      cells_[cell] = it->second;
+    }
+    //hashlib dicts may rehash on their first lookup after insertions.
+    //Doing one lookup in every table from the calling thread makes
+    //subsequent concurrent lookups read only.
+    void freeze() const {
+      index_.count(RTLIL::IdString());
+      cells_.count(nullptr);
+      for (const auto& model: models_) {
+        model.ports_.count(RTLIL::IdString());
+      }
+    }
+  private:
+    //deque: models do not move when new ones are added
+    std::deque<Model>             models_ {};
+    dict<RTLIL::IdString, size_t> index_  {};
+    dict<const RTLIL::Cell*, size_t> cells_ {};
 };
-using Models = std::map<std::string, Model>;
 
 void dumpInstTermReference(
     DBImplementation::NetComponentReference::Builder& dumpComponent,
@@ -93,16 +360,9 @@ void dumpInstTermReference(
   auto instTermRefenceBuilder = dumpComponent.initInstTermReference();
   instTermRefenceBuilder.setInstanceID(component.instanceID_);
   instTermRefenceBuilder.setTermID(component.termID_);
-  if (component.isBus_) {
+  if (component.isBus()) {
     instTermRefenceBuilder.setBit(component.bit_);
   }
-#if SNL_YOSYS_PLUGIN_DEBUG
-  std::cerr << "Dumping inst term reference: " << component.instanceID_ << ":" << component.termID_;
-  if (component.isBus_) {
-    std::cerr << "[" << component.bit_ << "]";
-  }
-  std::cerr << std::endl;
-#endif
 }
 
 void dumpTermReference(
@@ -110,97 +370,134 @@ void dumpTermReference(
     const Component& component) {
   auto termRefenceBuilder = dumpComponent.initTermReference();
   termRefenceBuilder.setTermID(component.termID_);
-  if (component.isBus_) {
+  if (component.isBus()) {
     termRefenceBuilder.setBit(component.bit_);
   }
-#if SNL_YOSYS_PLUGIN_DEBUG
-  std::cerr << "Dumping term reference: " << component.termID_;
-  if (component.isBus_) {
-    std::cerr << "[" << component.bit_ << "]";
-  }
-  std::cerr << std::endl;
-#endif
 }
 
 void dumpNetComponentReference(
     DBImplementation::NetComponentReference::Builder& dumpComponent,
     const Component& component) {
-  if (component.isTerm_) {
+  if (component.isTerm()) {
     dumpTermReference(dumpComponent, component);
   } else {
     dumpInstTermReference(dumpComponent, component);
   }
 }
 
+std::ostream& operator<<(std::ostream& stream, const Component& component) {
+  if (component.isTerm()) {
+    stream << "term " << component.termID_;
+  } else {
+    stream << "instance " << component.instanceID_ << " term " << component.termID_;
+  }
+  if (component.isBus()) {
+    stream << "[" << component.bit_ << "]";
+  }
+  return stream;
+}
+
+//Dumps the components of a flat bit in a ScalarNet or BusNetBit
+//builder. module, netName and hdlBit (NoBit for scalar nets) are only
+//traced.
+template<typename NetBitBuilder>
+void dumpNetBitComponents(
+  NetBitBuilder& dumpBit,
+  const RTLIL::Module* module,
+  const char* netName,
+  int hdlBit,
+  const Connectivity& connectivity,
+  size_t bit) {
+  size_t componentsSize = connectivity.getFanout(bit);
+  if (componentsSize > 0) {
+    auto components = dumpBit.initComponents(componentsSize);
+    size_t componentID = 0;
+    for (auto it = connectivity.begin(bit); it != connectivity.end(bit); ++it) {
+      SNL_TRACE(Components, module->name.c_str(), netName,
+        netName << (hdlBit != Component::NoBit ? "[" + std::to_string(hdlBit) + "]" : "")
+        << ": " << *it);
+      auto componentRefBuilder = components[componentID++];
+      dumpNetComponentReference(componentRefBuilder, *it);
+    }
+  }
+}
+
 void dumpScalarNet(
     DBImplementation::LibraryImplementation::SNLDesignImplementation::Net::Builder& dumpNet,
     const std::string& name,
     const Net& net,
+    const Connectivity& connectivity,
     size_t id) {
   auto scalarNetBuilder = dumpNet.initScalarNet();
   scalarNetBuilder.setId(id);
   scalarNetBuilder.setName(name);
-#if SNL_YOSYS_PLUGIN_DEBUG
-  std::cerr << "Dumping scalar net: " << name << " with ID: " << id << std::endl;
-#endif
-  assert(net.bits_.size() == 1);
-  printf("Dumping scalar net: %s with ID: %zu\n", name.c_str(), id);
-  auto bit = net.bits_[0];
-  size_t componentsSize = bit.components_.size();
-  if (componentsSize > 0) {
-    auto components = scalarNetBuilder.initComponents(componentsSize);
-    size_t componentID = 0;
-    for (auto component: bit.components_) {
-      auto componentRefBuilder = components[componentID++];
-      dumpNetComponentReference(componentRefBuilder, component);
-    }
-  }
+  SNL_TRACE(Nets, net.wire_->module->name.c_str(), net.wire_->name.c_str(),
+    "scalar net " << id << " " << name << " (" << net.wire_->name.c_str() << ")");
+  assert(net.wire_->width == 1);
+  dumpNetBitComponents(scalarNetBuilder, net.wire_->module, net.wire_->name.c_str(),
+    Component::NoBit, connectivity, net.firstBit_);
+}
+
+//Unnamed ASSIGN0 or ASSIGN1 net of the constant bits of module
+void dumpConstantNet(
+    DBImplementation::LibraryImplementation::SNLDesignImplementation::Net::Builder& dumpNet,
+    const RTLIL::Module* module,
+    DBImplementation::NetType type,
+    const Connectivity& connectivity,
+    size_t bit,
+    size_t id) {
+  auto scalarNetBuilder = dumpNet.initScalarNet();
+  scalarNetBuilder.setId(id);
+  scalarNetBuilder.setType(type);
+  auto traceName = type == DBImplementation::NetType::ASSIGN0 ? "1'b0" : "1'b1";
+  SNL_TRACE(Nets, module->name.c_str(), traceName,
+    "constant net " << id << " " << traceName << ", " << connectivity.getFanout(bit) << " components");
+  dumpNetBitComponents(scalarNetBuilder, module, traceName, Component::NoBit, connectivity, bit);
 }
 
 void dumpBusNetBit(
   DBImplementation::LibraryImplementation::SNLDesignImplementation::BusNetBit::Builder& dumpBit,
-  const Bit& bit) {
-  dumpBit.setBit(bit.bit_);
-#if SNL_YOSYS_PLUGIN_DEBUG
-  std::cerr << "Dumping bus net bit: " << bit.bit_ << std::endl;
-#endif
-  size_t componentsSize = bit.components_.size();
-  if (componentsSize > 0) {
-    auto components = dumpBit.initComponents(componentsSize);
-    size_t id = 0;
-    for (auto component: bit.components_) {
-      auto componentRefBuilder = components[id++];
-      dumpNetComponentReference(componentRefBuilder, component);
-    }
-  }
+  const Net& net,
+  int bit,
+  const Connectivity& connectivity,
+  size_t flatBit) {
+  dumpBit.setBit(bit);
+  dumpNetBitComponents(dumpBit, net.wire_->module, net.wire_->name.c_str(),
+    bit, connectivity, flatBit);
 }
 
 void dumpBusNet(
     DBImplementation::LibraryImplementation::SNLDesignImplementation::Net::Builder& dumpNet,
     const std::string& name,
     const Net& net,
+    const Connectivity& connectivity,
     size_t id) {
   auto busNetBuilder = dumpNet.initBusNet();
   busNetBuilder.setId(id);
   busNetBuilder.setName(name);
   busNetBuilder.setMsb(net.msb_);
   busNetBuilder.setLsb(net.lsb_);
-#if SNL_YOSYS_PLUGIN_DEBUG
-  std::cerr << "Dumping bus net: " << name << "[" << net.msb_ << ":" << net.lsb_ << "]" << std::endl;
-#endif
+  SNL_TRACE(Nets, net.wire_->module->name.c_str(), net.wire_->name.c_str(),
+    "bus net " << id << " " << name << "[" << net.msb_ << ":" << net.lsb_ << "]"
+    << " (" << net.wire_->name.c_str() << ")");
+  auto wire = net.wire_;
   auto bits = busNetBuilder.initBits(getSize(net.msb_, net.lsb_));
+  //bits are dumped from msb to lsb, offset 0 is the lsb
   size_t bid = 0;
-  for (auto bit: net.bits_) {
+  for (int offset = wire->width - 1; offset >= 0; --offset) {
     auto bitBuilder = bits[bid++];
-    dumpBusNetBit(bitBuilder, bit);
+    dumpBusNetBit(bitBuilder, net, getHDLBit(wire, offset), connectivity, net.firstBit_ + offset);
   }
 }
 
 void dumpInstParameter(
   DBImplementation::LibraryImplementation::SNLDesignImplementation::Instance::InstParameter::Builder& instParameter,
-  const std::string& name) {
+  const std::string& name,
+  const RTLIL::Const& value) {
   instParameter.setName(name);
-  //instParameter.setValue(snlInstParameter->getValue());
+  //instance parameters have no type: readers get it from the value format
+  ParameterType type;
+  instParameter.setValue(YosysParameter::format(value, type));
 }
 
 void dumpInstanceParameters(
@@ -212,36 +509,40 @@ void dumpInstanceParameters(
     size_t id = 0;
     for (auto it = cell->parameters.begin(); it != cell->parameters.end(); ++it) {
       auto instParameterBuilder = instParameters[id++];
-      dumpInstParameter(instParameterBuilder, getName(it->first.c_str()));
+      dumpInstParameter(instParameterBuilder, getName(it->first), it->second);
     }
   }
 }
 
+//value is nullptr for parameters without default value
 void dumpParameter(
   SNLDesignInterface::Parameter::Builder& parameter,
-  const std::string& name) {
+  const std::string& name,
+  const RTLIL::Const* value) {
   parameter.setName(name);
-  //parameter.setType(SNLtoCapNpParameterType(snlParameter->getType()));
-  //parameter.setValue(snlParameter->getValue());
+  if (value) {
+    ParameterType type;
+    auto text = YosysParameter::format(*value, type);
+    parameter.setType(type);
+    parameter.setValue(text);
+  }
 }
 
 void dumpParameters(
   SNLDesignInterface::Builder& design,
   RTLIL::Module* module) {
-#if SNL_YOSYS_PLUGIN_DEBUG
-  std::cerr << "Dumping parameters: " << module->avail_parameters.size() << std::endl;
-  for (auto parameter: module->avail_parameters) {
-    std::cerr << "Dumping parameter: " << parameter.c_str() << std::endl;
-
-  }
-#endif
   size_t parametersSize = module->avail_parameters.size();
   if (parametersSize > 0) {
     size_t id = 0;
     auto parameters = design.initParameters(parametersSize);
     for (auto parameter: module->avail_parameters) {
       auto parameterBuilder = parameters[id++];
-      dumpParameter(parameterBuilder, getName(parameter));
+      auto it = module->parameter_default_values.find(parameter);
+      SNL_TRACE(Parameters, module->name.c_str(), parameter.c_str(),
+        "parameter " << parameter.c_str() << " of " << module->name.c_str()
+        << (it != module->parameter_default_values.end() ? " = " + it->second.as_string() : ""));
+      dumpParameter(parameterBuilder, getName(parameter),
+        it != module->parameter_default_values.end() ? &it->second : nullptr);
     }
   }
 }
@@ -249,28 +550,23 @@ void dumpParameters(
 void dumpScalarTerm(
   SNLDesignInterface::Term::Builder& term,
   const RTLIL::Wire* wire,
-  size_t id,
-  Model& model) {
+  size_t id) {
   auto scalarTermBuilder = term.initScalarTerm();
   scalarTermBuilder.setId(id);
   auto termName = getName(wire->name);
-  model.terms_[wire->port_id] = id;
   scalarTermBuilder.setName(termName);
   scalarTermBuilder.setDirection(YosysToCapnPDirection(wire));
-  //std::cerr << "ID: " << id << ", Name: " << termName << ", Port ID: " << wire->port_id << std::endl;
-  printf("Dumping scalar builder: %s\n", scalarTermBuilder.toString().flatten().cStr());
-  printf("Dumping scalar term: %s with ID: %zu, Port ID: %d\n", termName.c_str(), id, wire->port_id);
-  std::cerr << "Dumping scalar term: " << termName << std::endl;
+  SNL_TRACE(Terms, wire->module->name.c_str(), wire->name.c_str(),
+    "scalar term " << id << " " << termName << " of " << wire->module->name.c_str()
+    << ", port " << wire->port_id);
 }
 
 void dumpBusTerm(
   SNLDesignInterface::Term::Builder& term,
   const RTLIL::Wire* wire,
-  size_t id,
-  Model& model) {
+  size_t id) {
   auto busTermBuilder = term.initBusTerm();
   auto termName = getName(wire->name);
-  model.terms_[wire->port_id] = id;
   busTermBuilder.setId(id);
   busTermBuilder.setName(termName);
   busTermBuilder.setDirection(YosysToCapnPDirection(wire));
@@ -280,13 +576,33 @@ void dumpBusTerm(
   auto lsb = (wire->upto) ? end : start;
   busTermBuilder.setMsb(msb);
   busTermBuilder.setLsb(lsb);
-  std::cerr << "Dumping bus: " << termName << "[" << msb << "," << lsb << "]" << std::endl;
+  SNL_TRACE(Terms, wire->module->name.c_str(), wire->name.c_str(),
+    "bus term " << id << " " << termName << "[" << msb << ":" << lsb << "] of "
+    << wire->module->name.c_str() << ", port " << wire->port_id);
+}
+
+//Numbers the ports of module in wires order.
+//Separate from dumpPorts: implementations need the term IDs of a model
+//even when its interface comes from the cache.
+void collectTerms(const RTLIL::Module* module, Model& model) {
+  int maxPortID = 0;
+  for (auto wire: module->wires()) {
+    maxPortID = std::max(maxPortID, wire->port_id);
+  }
+  model.terms_.assign(maxPortID + 1, -1);
+  int termID = 0;
+  for (auto wire: module->wires()) {
+    if (wire->port_id != 0) {
+      model.ports_[wire->name] = Port {termID, wire->width, wire->start_offset, wire->upto};
+      model.terms_[wire->port_id] = termID++;
+    }
+  }
 }
 
 void dumpPorts(
   SNLDesignInterface::Builder& design,
   RTLIL::Module* module,
-  Model& model) {
+  const Model& model) {
   using Ports = std::vector<RTLIL::Wire*>;
   Ports ports;
   for (auto wire : module->wires()) {
@@ -297,365 +613,1829 @@ void dumpPorts(
   }
   if (not ports.empty()) {
     auto terms = design.initTerms(ports.size());
-    size_t portID = 0;
-    for (auto wire : module->wires()) {
-      if (wire->port_id == 0) {
-        continue;
-      }
-      auto term = terms[portID];
+    for (auto wire: ports) {
+      auto termID = model.getTermID(wire);
+      auto term = terms[termID];
       if (wire->width == 1) {
-        dumpScalarTerm(term, wire, portID, model);
+        dumpScalarTerm(term, wire, termID);
       } else {
-        dumpBusTerm(term, wire, portID, model);
+        dumpBusTerm(term, wire, termID);
       }
-      ++portID;
     }
   }
 }
 
-void collectBusNet(
-  const RTLIL::Wire* wire,
-  const Terms& terms,
-  Nets& nets) {
-  auto start = wire->start_offset;
-  auto end = wire->start_offset + wire->width - 1;
-  auto msb = (wire->upto) ? start : end;
-  auto lsb = (wire->upto) ? end : start;
-#if SNL_YOSYS_PLUGIN_DEBUG
-  std::cerr << "Collect bus net: " << getName(wire->name) << "[" << msb << "," << lsb << "]" << std::endl;
-#endif
-  auto insertion = nets.insert(std::make_pair(wire, Net(msb, lsb)));
-  assert(insertion.second);
-  if (wire->port_id != 0) {
-    auto it = insertion.first;
-    auto& net = it->second;
-    auto portIt = terms.find(wire->port_id);
-    size_t id = 0;
-    int incr = (wire->upto) ? +1 : -1;
-    for (auto bit=msb; (wire->upto)?bit<=lsb:bit>=lsb; bit+=incr) {
-      net.bits_[id].components_.emplace_back(Component(portIt->second, true, bit));
-#if SNL_YOSYS_PLUGIN_DEBUG
-      std::cerr << "Connect bus term bit: " << getName(wire->name) << "[" << bit << "], @" << id << std::endl;
-#endif
-      ++id;
+//Creates the net of wire, numbering its bits from bitsSize
+void collectWire(
+  RTLIL::Wire* wire,
+  Nets& nets,
+  NetBitIndex& netBitIndex,
+  size_t& bitsSize) {
+  if (wire->width != 1) {
+    auto start = wire->start_offset;
+    auto end = wire->start_offset + wire->width - 1;
+    auto msb = (wire->upto) ? start : end;
+    auto lsb = (wire->upto) ? end : start;
+    nets.emplace_back(Net(wire, bitsSize, msb, lsb));
+  } else {
+    nets.emplace_back(Net(wire, bitsSize));
+  }
+  netBitIndex.addWire(wire, bitsSize);
+  bitsSize += wire->width;
+}
+
+//Ordered by name so that design and primitive IDs, hence the output
+//bytes, do not depend on pointer values. Cells and wires are dumped in
+//their RTLIL order, which only depends on how the design was built.
+using Modules = std::set<RTLIL::Module*, RTLIL::sort_by_name_str>;
+
+struct DumpOptions {
+  unsigned  jobs_       {1};
+  //designs per implementation file, 0 for a single file
+  size_t    splitSize_  {0};
+  //unpacked messages keep the segment table and word aligned segments
+  //so that readers can mmap them and access them in place
+  bool      packed_     {true};
+  //zstd compressed frames (see snl_frames.h), uncompressed by default
+  bool      compress_   {false};
+  //exports structurally identical user modules once (-dedup)
+  bool      dedup_      {false};
+  size_t    frameSize_  {4 << 20};
+  //collects export statistics when set (-stats)
+  SNLStats* stats_      {nullptr};
+  //reuses unchanged design fragments when set (-cache)
+  SNLCache* cache_      {nullptr};
+  //writes the files in the background
+  SNLWriter* writer_    {nullptr};
+  //-top module, exported with its dependencies instead of the selection
+  RTLIL::Module* top_   {nullptr};
+  //one message per design and db_designs.idx (-index)
+  bool      indexed_    {false};
+  //numbering of instances and nets (-order)
+  SNLOrder::Type order_ {SNLOrder::Type::Default};
+  //x and z constant bits: unconnected (Sx) or tied to S0 or S1 (-tie-xz)
+  RTLIL::State tieXZ_   {RTLIL::State::Sx};
+
+  //Top design of the export: the -top module, otherwise the module with
+  //the top attribute
+  bool isTop(const RTLIL::Module* module) const {
+    return top_ ? module == top_ : module->get_bool_attribute(ID::top);
+  }
+};
+
+//Bump when the content of cached fragments changes for the same RTLIL,
+//and add the options changing fragments to the keys below.
+constexpr uint64_t CacheVersion = 4;
+
+//Cache key of a user design interface: design IDs are not part of the
+//key, they are set once the fragment is copied.
+YosysHash::Key getInterfaceKey(const RTLIL::Module* module) {
+  YosysHash hash;
+  hash.add(CacheVersion);
+  hash.addString("interface");
+  hash.addId(module->name);
+  for (auto wire: module->wires()) {
+    if (wire->port_id != 0) {
+      hash.addWire(wire);
     }
   }
+  return hash.getKey();
 }
 
-void collectScalarNet(
-  const RTLIL::Wire* wire,
-  const Terms& terms,
-  Nets& nets) {
-  auto insertion = nets.insert(std::make_pair(wire, Net()));
-  assert(insertion.second);
-  //collect port
-  if (wire->port_id != 0) {
-    auto it = insertion.first;
-    auto& net = it->second;
-    auto portIt = terms.find(wire->port_id);
-    assert(portIt != terms.end());
-    assert(net.bits_.size() == 1);
-    net.bits_.back().components_.emplace_back(Component(portIt->second, false, 0));
+//Cache key of a design implementation: covers the module contents and,
+//for each instance, the model terms the connections are resolved
+//against, the order of instances and nets and the x and z bits tie.
+//Model IDs are not part of the key: they change when modules are added
+//or removed, and are set once the fragment is copied (see
+//setModelReferences).
+YosysHash::Key getImplementationKey(
+  const RTLIL::Module* module,
+  const Models& models,
+  const DumpOptions& options) {
+  YosysHash hash;
+  hash.add(CacheVersion);
+  hash.addString("implementation");
+  hash.add(static_cast<uint64_t>(options.order_));
+  hash.add(static_cast<uint64_t>(options.tieXZ_));
+  hash.addId(module->name);
+  hash.add(module->wires().size());
+  for (auto wire: module->wires()) {
+    hash.addWire(wire);
+  }
+  hash.add(module->cells().size());
+  for (auto cell: module->cells()) {
+    hash.addId(cell->name);
+    hash.addId(cell->type);
+    auto model = models.find(cell);
+    hash.add(model != nullptr);
+    hash.add(cell->parameters.size());
+    for (const auto& parameter: cell->parameters) {
+      hash.addId(parameter.first);
+      hash.addConst(parameter.second);
+    }
+    hash.add(cell->connections().size());
+    for (const auto& conn: cell->connections()) {
+      hash.addId(conn.first);
+      auto port = model ? model->getPort(conn.first) : nullptr;
+      hash.add(port != nullptr);
+      if (port) {
+        hash.add(port->termID_);
+        hash.add(port->width_);
+        hash.add(port->startOffset_);
+        hash.add(port->upto_);
+      }
+      hash.addSig(conn.second);
+    }
+  }
+  hash.add(module->connections().size());
+  for (const auto& connection: module->connections()) {
+    hash.addSig(connection.first);
+    hash.addSig(connection.second);
   }
+  return hash.getKey();
 }
 
-void collectWire(
-  const RTLIL::Wire* wire,
-  const Terms& terms,
-  Nets& nets) {
-  //Will construct all nets and also collect terminals
-#if SNL_YOSYS_PLUGIN_DEBUG
-  YosysDebug::print(wire, 0);
+//Duplicate user module and the representative module it is exported as
+using ModuleAliases = std::vector<std::pair<RTLIL::Module*, RTLIL::Module*>>;
+using StructureKeys = dict<const RTLIL::Module*, YosysHash::Key>;
+
+//Structural key of a user module for -dedup: its contents without its
+//name, where instantiated user modules contribute their own structural
+//key instead of their name, so that equivalent hierarchies share a key.
+//keys memoizes the modules already hashed.
+YosysHash::Key getStructureKey(
+  const RTLIL::Module* module,
+  const Modules& userModules,
+  StructureKeys& keys) {
+  auto it = keys.find(module);
+  if (it != keys.end()) {
+    return it->second;
+  }
+  YosysHash hash;
+  hash.addString("structure");
+  hash.add(module->wires().size());
+  for (auto wire: module->wires()) {
+    hash.addWire(wire);
+  }
+  hash.add(module->cells().size());
+  for (auto cell: module->cells()) {
+    hash.addId(cell->name);
+    auto child = module->design->module(cell->type);
+    if (child and userModules.count(child)) {
+      hash.add(1);
+      hash.addString(getStructureKey(child, userModules, keys));
+    } else {
+      hash.add(0);
+      hash.addId(cell->type);
+    }
+    hash.add(cell->parameters.size());
+    for (const auto& parameter: cell->parameters) {
+      hash.addId(parameter.first);
+      hash.addConst(parameter.second);
+    }
+    hash.add(cell->connections().size());
+    for (const auto& conn: cell->connections()) {
+      hash.addId(conn.first);
+      hash.addSig(conn.second);
+    }
+  }
+  hash.add(module->connections().size());
+  for (const auto& connection: module->connections()) {
+    hash.addSig(connection.first);
+    hash.addSig(connection.second);
+  }
+  auto key = hash.getKey();
+  keys[module] = key;
+  return key;
+}
+
+//Keeps one user module per structural class in userModules and returns
+//the others with their representative: the top module when it is in
+//the class, the module with the smallest name otherwise.
+ModuleAliases dedupModules(Modules& userModules, const DumpOptions& options) {
+  StructureKeys keys;
+  std::map<YosysHash::Key, RTLIL::Module*> representatives;
+  auto isPreferred = [&](const RTLIL::Module* module, const RTLIL::Module* representative) {
+    bool isTop = options.isTop(module);
+    if (isTop != options.isTop(representative)) {
+      return isTop;
+    }
+    return strcmp(module->name.c_str(), representative->name.c_str()) < 0;
+  };
+  for (auto module: userModules) {
+    auto& representative = representatives[getStructureKey(module, userModules, keys)];
+    if (not representative or isPreferred(module, representative)) {
+      representative = module;
+    }
+  }
+  ModuleAliases aliases;
+  for (auto module: userModules) {
+    auto representative = representatives[keys.at(module)];
+    if (representative != module) {
+      aliases.emplace_back(module, representative);
+    }
+  }
+  for (const auto& alias: aliases) {
+    userModules.erase(alias.first);
+  }
+  return aliases;
+}
+
+//Duplicate modules resolve to the design of their representative.
+//Their terms are the same: ports are part of the structural key.
+void addModelAliases(const ModuleAliases& aliases, Models& models) {
+  for (const auto& [module, representative]: aliases) {
+    auto model = models.find(representative->name);
+    assert(model);
+    auto alias = models.add(module->name, Model(model->libraryID_, model->designID_));
+    assert(alias);
+    collectTerms(module, *alias);
+  }
+}
+
+//Writes through SNLWriter::writeAll, which counts the bytes of stream
+//items and retries interrupted writes.
+class WriterOutputStream: public kj::OutputStream {
+  public:
+    explicit WriterOutputStream(int fd): fd_(fd) {}
+    void write(const void* buffer, size_t size) override {
+      SNLWriter::writeAll(fd_, buffer, size);
+    }
+  private:
+    int fd_;
+};
+
+//Queues message to be written in path by options.writer_.
+//The writer owns the message until it is written.
+void writeMessage(
+  const std::filesystem::path& path,
+  std::unique_ptr<capnp::MallocMessageBuilder> message,
+  const DumpOptions& options) {
+  //only unpacked messages have a size known before writing, as needed by streams
+  auto size = SNLWriter::UnknownSize;
+  if (not options.packed_ and not options.compress_) {
+    size = capnp::computeSerializedSizeInWords(*message) * sizeof(capnp::word);
+  }
+  std::shared_ptr<capnp::MallocMessageBuilder> sharedMessage(std::move(message));
+  auto packed = options.packed_;
+#ifdef SNL_WITH_ZSTD
+  auto compress = options.compress_;
+  auto frameSize = options.frameSize_;
+  auto jobs = options.jobs_;
 #endif
-  if (wire->width != 1) {
-    collectBusNet(wire, terms, nets);
-  } else {
-    collectScalarNet(wire, terms, nets);
+  options.writer_->write(path, [=](int fd) {
+#ifdef SNL_WITH_ZSTD
+    if (compress) {
+      //serialize in memory then compress frames in parallel
+      kj::VectorOutputStream stream;
+      if (packed) {
+        capnp::writePackedMessage(stream, *sharedMessage);
+      } else {
+        capnp::writeMessage(stream, *sharedMessage);
+      }
+      auto bytes = stream.getArray();
+      SNLFrames::write(fd, bytes.begin(), bytes.size(), frameSize, SNLFrames::DefaultLevel, jobs);
+      return;
+    }
+#endif
+    WriterOutputStream stream(fd);
+    if (packed) {
+      capnp::writePackedMessage(stream, *sharedMessage);
+    } else {
+      capnp::writeMessage(stream, *sharedMessage);
+    }
+  }, size);
+}
+
+//Message arenas are sized from word estimates computed before building:
+//a message within its estimate is built in one segment, without the
+//reallocations and segment tables of the default growth heuristic.
+//Estimates count struct and list words, text is padded to words.
+size_t getTextWords(size_t size) {
+  //NUL terminated
+  return (size + sizeof(capnp::word)) / sizeof(capnp::word);
+}
+
+unsigned getFirstSegmentWords(size_t words) {
+  //capnp segments are limited to 2^29 words, larger messages get more segments
+  constexpr size_t MaxSegmentWords = (size_t(1) << 29) - 1;
+  //slack for the rounding of estimates
+  words += words / 32;
+  return std::clamp<size_t>(words, capnp::SUGGESTED_FIRST_SEGMENT_WORDS, MaxSegmentWords);
+}
+
+//Estimated words of a DBInterface message without its designs
+size_t getInterfaceLibrariesWords(size_t librariesSize) {
+  return 2 + capnp::sizeInWords<DBInterface>() + capnp::sizeInWords<DesignReference>()
+    + librariesSize * (1 + capnp::sizeInWords<DBInterface::LibraryInterface>());
+}
+
+//Estimated words of the interface of module in a DBInterface message
+size_t getInterfaceWords(const RTLIL::Module* module) {
+  size_t words = capnp::sizeInWords<SNLDesignInterface>()
+    + getTextWords(strlen(module->name.c_str()));
+  if (not module->ports.empty()) {
+    words += 1 + module->ports.size() * capnp::sizeInWords<SNLDesignInterface::Term>();
+    for (const auto& port: module->ports) {
+      words += capnp::sizeInWords<SNLDesignInterface::BusTerm>()
+        + getTextWords(strlen(port.c_str()));
+    }
+  }
+  if (not module->avail_parameters.empty()) {
+    words += 1;
+    for (const auto& parameter: module->avail_parameters) {
+      words += capnp::sizeInWords<SNLDesignInterface::Parameter>()
+        + getTextWords(strlen(parameter.c_str()));
+      auto it = module->parameter_default_values.find(parameter);
+      if (it != module->parameter_default_values.end()) {
+        //hexadecimal values are a quarter of the bits, strings an eighth
+        words += getTextWords(it->second.size() / 4 + 16);
+      }
+    }
+  }
+  return words;
+}
+
+//Fills designs[id] from the cache, or with build then caches it
+template<typename Build>
+void dumpDesignInterface(
+  capnp::List<SNLDesignInterface>::Builder& designs,
+  size_t id,
+  const YosysHash::Key& key,
+  const DumpOptions& options,
+  const Build& build) {
+  auto cache = options.cache_;
+  if (cache) {
+    if (auto fragment = cache->load(key, "interface")) {
+      designs.setWithCaveats(id, fragment->getRoot<SNLDesignInterface>());
+      designs[id].setId(id);
+      if (options.stats_) {
+        options.stats_->addCounter("cache_hits", 1);
+      }
+      return;
+    }
+  }
+  auto design = designs[id];
+  design.setId(id);
+  build(design);
+  if (cache) {
+    capnp::MallocMessageBuilder fragment;
+    fragment.setRoot(design.asReader());
+    if (not cache->store(key, "interface", fragment)) {
+      log_warning("Cannot write cache entry %s.interface\n", key.c_str());
+    }
+    if (options.stats_) {
+      options.stats_->addCounter("cache_misses", 1);
+    }
   }
 }
 
-using Modules = std::set<RTLIL::Module*>;
+void dumpPrimitive(
+  capnp::List<SNLDesignInterface>::Builder& primitives,
+  size_t primitiveID,
+  RTLIL::Module* primitiveModule,
+  Models& models) {
+  auto name = getName(primitiveModule->name); 
+  SNL_TRACE(Modules, primitiveModule->name.c_str(), nullptr,
+    "primitive " << primitiveID << " " << name);
+  auto model = models.add(primitiveModule->name, Model(0, primitiveID));
+  if (not model) {
+    log_error("Model %s already in map\n", log_id(name));
+  }
+  collectTerms(primitiveModule, *model);
+  //primitives are small and many: they are rebuilt rather than cached
+  //in one entry each
+  auto primitive = primitives[primitiveID];
+  primitive.setId(primitiveID);
+  primitive.setName(name);
+  primitive.setType(DesignType::PRIMITIVE);
+  //dump parameters
+  dumpParameters(primitive, primitiveModule);
+  //dump ports
+  dumpPorts(primitive, primitiveModule, *model);
+}
 
-void dumpInterface(
-  const Modules& primitiveModules,
-  const Modules& userModules,
-  const std::filesystem::path& interfacePath, Models& models) {
-  ::capnp::MallocMessageBuilder message;
+//Primitives library written with -write-primitives-library: a
+//DBInterface message holding one PRIMITIVES library, unpacked so that
+//it is mapped and read in place.
+//With -primitives-library, its primitives are registered as models with
+//their library IDs, and copied as is at the start of the primitives
+//library of db_interface.snl: only the primitives it does not define
+//are collected and dumped.
+class PrimitivesLibrary {
+  public:
+    PrimitivesLibrary(const std::filesystem::path& path) {
+      SNLManifest manifest;
+      manifest.packed_ = false;
+      try {
+        message_ = std::make_unique<SNLMessage>(path, manifest, 1);
+      } catch (const std::exception& e) {
+        log_error("Cannot read primitives library: %s\n", e.what());
+      }
+      for (auto library: message_->getRoot<DBInterface>().getLibraryInterfaces()) {
+        if (library.getType() == DBInterface::LibraryType::PRIMITIVES) {
+          primitives_ = library.getSnlDesignInterfaces();
+          return;
+        }
+      }
+      log_error("No primitives library in %s\n", path.c_str());
+    }
+    const capnp::List<SNLDesignInterface>::Reader& getPrimitives() const {
+      return primitives_;
+    }
+    void addModels(Models& models) const {
+      for (size_t primitiveID = 0; primitiveID < primitives_.size(); ++primitiveID) {
+        auto primitive = primitives_[primitiveID];
+        std::string name = primitive.getName();
+        if (primitive.getId() != primitiveID) {
+          log_error("Primitive %s of the primitives library has ID %u instead of %zu\n",
+            name.c_str(), unsigned(primitive.getId()), primitiveID);
+        }
+        auto model = models.add(RTLIL::escape_id(name), Model(0, primitiveID));
+        if (not model) {
+          log_error("Model %s already in map\n", name.c_str());
+        }
+        for (auto term: primitive.getTerms()) {
+          Port port;
+          std::string termName;
+          if (term.isScalarTerm()) {
+            auto scalarTerm = term.getScalarTerm();
+            port.termID_ = scalarTerm.getId();
+            termName = scalarTerm.getName();
+          } else {
+            auto busTerm = term.getBusTerm();
+            port.termID_ = busTerm.getId();
+            port.width_ = getSize(busTerm.getMsb(), busTerm.getLsb());
+            port.startOffset_ = std::min(busTerm.getMsb(), busTerm.getLsb());
+            port.upto_ = busTerm.getMsb() < busTerm.getLsb();
+            termName = busTerm.getName();
+          }
+          model->ports_[RTLIL::escape_id(termName)] = port;
+        }
+      }
+    }
+  private:
+    std::unique_ptr<SNLMessage>             message_    {};
+    capnp::List<SNLDesignInterface>::Reader primitives_ {};
+};
 
-  DBInterface::Builder db = message.initRoot<DBInterface>();
+//Writes all the blackbox modules of design as a primitives library
+void dumpPrimitivesLibrary(
+  RTLIL::Design* design,
+  const std::filesystem::path& path,
+  const DumpOptions& options) {
+  Modules primitiveModules;
+  for (auto module: design->modules()) {
+    if (module->get_blackbox_attribute()) {
+      primitiveModules.insert(module);
+    }
+  }
+  DumpOptions libraryOptions;
+  libraryOptions.packed_ = false;
+  libraryOptions.writer_ = options.writer_;
+  Models models;
+  size_t words = getInterfaceLibrariesWords(1);
+  for (auto primitiveModule: primitiveModules) {
+    words += getInterfaceWords(primitiveModule);
+  }
+  auto message = std::make_unique<capnp::MallocMessageBuilder>(getFirstSegmentWords(words));
+  DBInterface::Builder db = message->initRoot<DBInterface>();
   db.setId(1);
-  auto libraries = db.initLibraryInterfaces(2);
+  auto libraries = db.initLibraryInterfaces(1);
   auto primitivesLibrary = libraries[0];
   primitivesLibrary.setId(0); 
   primitivesLibrary.setType(DBInterface::LibraryType::PRIMITIVES);
-  auto designsLibrary = libraries[1];
-  designsLibrary.setId(1);
-
   auto primitives = primitivesLibrary.initSnlDesignInterfaces(primitiveModules.size());
   size_t primitiveID = 0;
   for (auto primitiveModule: primitiveModules) {
-    auto primitive = primitives[primitiveID];
-    primitive.setId(primitiveID);
-    auto name = getName(primitiveModule->name); 
-    std::cerr << "Dumping primitive: " << name << std::endl;
-    if (models.find(name) != models.end()) {
-      log_error("Model %s already in map", log_id(name));
-    }
-    auto it = models.insert(std::pair<std::string, Model>(name, Model(0, primitiveID)));
-    assert(it.second);
-    auto& model = it.first->second;
-    primitive.setName(name);
-    primitive.setType(DesignType::PRIMITIVE);
-    //dump parameters
-    dumpParameters(primitive, primitiveModule);
-    //dump ports
-    dumpPorts(primitive, primitiveModule, model);
-    ++primitiveID;
-  }
-
-  auto designs = designsLibrary.initSnlDesignInterfaces(userModules.size());
-  size_t designID = 0;
-  int topDesignID = -1;
+    dumpPrimitive(primitives, primitiveID++, primitiveModule, models);
+  }
+  writeMessage(path, std::move(message), libraryOptions);
+  log("Writing %zu primitives to %s.\n", primitiveModules.size(), path.c_str());
+}
+
+void dumpInterface(
+  const PrimitivesLibrary* primitivesLibraryFile,
+  const Modules& primitiveModules,
+  const Modules& userModules,
+  const std::filesystem::path& interfacePath,
+  Models& models,
+  const DumpOptions& options) {
+  size_t words = getInterfaceLibrariesWords(2);
+  if (primitivesLibraryFile) {
+    for (auto primitive: primitivesLibraryFile->getPrimitives()) {
+      words += primitive.totalSize().wordCount;
+    }
+  }
+  for (auto primitiveModule: primitiveModules) {
+    words += getInterfaceWords(primitiveModule);
+  }
   for (auto userModule: userModules) {
-    if (userModule->get_bool_attribute(ID::top)) {
-      topDesignID = designID;
+    words += getInterfaceWords(userModule);
+  }
+  auto message = std::make_unique<capnp::MallocMessageBuilder>(getFirstSegmentWords(words));
+  {
+    SNLStats::Timer timer(options.stats_, "interface");
+    DBInterface::Builder db = message->initRoot<DBInterface>();
+    db.setId(1);
+    auto libraries = db.initLibraryInterfaces(2);
+    auto primitivesLibrary = libraries[0];
+    primitivesLibrary.setId(0); 
+    primitivesLibrary.setType(DBInterface::LibraryType::PRIMITIVES);
+    auto designsLibrary = libraries[1];
+    designsLibrary.setId(1);
+
+    size_t libraryPrimitivesSize =
+      primitivesLibraryFile ? primitivesLibraryFile->getPrimitives().size() : 0;
+    auto primitives = primitivesLibrary.initSnlDesignInterfaces(
+      libraryPrimitivesSize + primitiveModules.size());
+    size_t primitiveID = 0;
+    for (; primitiveID < libraryPrimitivesSize; ++primitiveID) {
+      primitives.setWithCaveats(primitiveID, primitivesLibraryFile->getPrimitives()[primitiveID]);
+    }
+    for (auto primitiveModule: primitiveModules) {
+      dumpPrimitive(primitives, primitiveID++, primitiveModule, models);
     }
-    auto design = designs[designID];
-    design.setId(designID);
-    auto name = getName(userModule->name);
-    std::cerr << "Dumping module: " << name << std::endl;
-    design.setName(name);
-    auto it = models.insert(std::pair<std::string, Model>(name, Model(1, designID)));
-    assert(it.second);
-    auto& model = it.first->second;
 
-    //collect ports
-    dumpPorts(design, userModule, model);
+    auto designs = designsLibrary.initSnlDesignInterfaces(userModules.size());
+    size_t designID = 0;
+    int topDesignID = -1;
+    for (auto userModule: userModules) {
+      if (options.isTop(userModule)) {
+        topDesignID = designID;
+      }
+      auto name = getName(userModule->name);
+      SNL_TRACE(Modules, userModule->name.c_str(), nullptr,
+        "design " << designID << " " << name);
+      auto model = models.add(userModule->name, Model(1, designID));
+      assert(model);
+      collectTerms(userModule, *model);
+      dumpDesignInterface(designs, designID,
+        getInterfaceKey(userModule), options,
+        [&](SNLDesignInterface::Builder& design) {
+          design.setName(name);
+          //collect ports
+          dumpPorts(design, userModule, *model);
+        });
+      ++designID;
+    }
 
-    ++designID;
+    if (topDesignID != -1) {
+      auto designReferenceBuilder = db.initTopDesignReference();
+      designReferenceBuilder.setDbID(1);
+      designReferenceBuilder.setLibraryID(1);
+      designReferenceBuilder.setDesignID(topDesignID);
+    }
   }
 
-  if (topDesignID != -1) {
-    auto designReferenceBuilder = db.initTopDesignReference();
-    designReferenceBuilder.setDbID(1);
-    designReferenceBuilder.setLibraryID(1);
-    designReferenceBuilder.setDesignID(topDesignID);
+  writeMessage(interfacePath, std::move(message), options);
+}
+
+using DesignImplementation = DBImplementation::LibraryImplementation::SNLDesignImplementation;
+using Warnings = std::vector<std::string>;
+
+//Per design statistics, accumulated by workers and merged by the caller
+struct DesignStats {
+  double  collectNets_        {0};
+  double  resolveConnections_ {0};
+  double  build_              {0};
+  double  order_              {0};
+  size_t  instances_          {0};
+  size_t  nets_               {0};
+  size_t  netBits_            {0};
+  size_t  components_         {0};
+  size_t  maxFanout_          {0};
+  size_t  cacheHits_          {0};
+  size_t  cacheMisses_        {0};
+};
+
+//The record of a built implementation is stored next to it in the
+//cache, as a list of integers: its counters, added back on a hit so that
+//-stats counts cached designs as if they were built, then the RTLIL cell
+//index of each instance, which gives the models of the instances of the
+//cached design.
+bool storeDesignRecord(
+  const SNLCache& cache,
+  const std::string& key,
+  const RTLIL::Module* module,
+  const std::vector<const RTLIL::Cell*>& instanceCells,
+  const DesignStats& stats) {
+  dict<const RTLIL::Cell*, size_t> cellIndexes;
+  size_t cellIndex = 0;
+  for (auto cell: module->cells()) {
+    cellIndexes[cell] = cellIndex++;
   }
+  capnp::MallocMessageBuilder message(8 + instanceCells.size());
+  auto record = message.getRoot<capnp::AnyPointer>().initAs<capnp::List<uint64_t>>(
+    5 + instanceCells.size());
+  record.set(0, stats.instances_);
+  record.set(1, stats.nets_);
+  record.set(2, stats.netBits_);
+  record.set(3, stats.components_);
+  record.set(4, stats.maxFanout_);
+  for (size_t i = 0; i < instanceCells.size(); ++i) {
+    record.set(5 + i, cellIndexes.at(instanceCells[i]));
+  }
+  return cache.store(key, "record", message);
+}
 
-  int fd = open(
-    interfacePath.c_str(),
-    O_CREAT | O_WRONLY,
-    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-  writePackedMessageToFd(fd, message);
-  close(fd);
+//Returns false if the record of key is not cached or does not match the
+//cached design and module, which must then be rebuilt.
+//instanceModels gets the model of each instance of design.
+bool loadDesignRecord(
+  const SNLCache& cache,
+  const std::string& key,
+  SNLCache::Fragment& design,
+  const RTLIL::Module* module,
+  const Models& models,
+  DesignStats& stats,
+  std::vector<const Model*>& instanceModels) {
+  auto fragment = cache.load(key, "record");
+  if (not fragment) {
+    return false;
+  }
+  try {
+    auto record = fragment->getRoot<capnp::AnyPointer>().getAs<capnp::List<uint64_t>>();
+    if (record.size() < 5
+      or record.size() - 5 != record[0]
+      or design.getRoot<DesignImplementation>().getInstances().size() != record[0]) {
+      return false;
+    }
+    std::vector<const RTLIL::Cell*> cells(module->cells().begin(), module->cells().end());
+    instanceModels.clear();
+    for (size_t i = 5; i < record.size(); ++i) {
+      auto model = record[i] < cells.size() ? models.find(cells[record[i]]) : nullptr;
+      if (not model) {
+        return false;
+      }
+      instanceModels.push_back(model);
+    }
+    stats.instances_ += record[0];
+    stats.nets_ += record[1];
+    stats.netBits_ += record[2];
+    stats.components_ += record[3];
+    stats.maxFanout_ = std::max(stats.maxFanout_, size_t(record[4]));
+  } catch (const std::exception&) {
+    //malformed entry, rebuilt by the caller
+    return false;
+  }
+  return true;
 }
 
-void dumpImplementation(
-  const RTLIL::Design* ydesign,
-  const Modules& userModules,
-  const std::filesystem::path& implementationPath, const Models& models) {
-  ::capnp::MallocMessageBuilder message;
+//Points the instances of a cached design at the current IDs of their
+//models, instanceModels in instance ID order
+void setModelReferences(
+  DesignImplementation::Builder design,
+  const std::vector<const Model*>& instanceModels) {
+  auto instances = design.getInstances();
+  for (size_t i = 0; i < instances.size(); ++i) {
+    auto modelReference = instances[i].getModelReference();
+    modelReference.setLibraryID(instanceModels[i]->libraryID_);
+    modelReference.setDesignID(instanceModels[i]->designID_);
+  }
+}
 
-  DBImplementation::Builder db = message.initRoot<DBImplementation>();
-  db.setId(1);
-  auto libraries = db.initLibraryImplementations(1);
-  auto library = libraries[0];
-  library.setId(1); 
-
-  auto designs = library.initSnlDesignImplementations(userModules.size());
-  size_t designID = 0;
-  for (auto& userModule: userModules) {
-    auto mit = models.find(getName(userModule->name));
-    assert(mit != models.end());
-    const Terms& terms = mit->second.terms_;
-    auto design = designs[designID]; 
-    design.setId(designID++);
-    //collect all nets: bus and scalar
-    //collect terminals at the same time
-    Nets nets;
-    for (auto wire: userModule->wires()) {
-      collectWire(wire, terms, nets); 
-    }
-    size_t instancesSize = 0;
-    //filter special instances (for instance $print))
-    for (auto cell: userModule->cells()) {
-      auto modelIt = models.find(getName(cell->type));
-      if (modelIt == models.end()) {
-        log_warning("Model type %s not found in map for cell %s", cell->type.c_str(), cell->name.c_str());
-      } else {
-        ++instancesSize;
-      }
+//Builds the implementation of userModule in its own message, sized
+//from the resolved connectivity.
+//Only reads RTLIL, so it can run concurrently for different modules.
+//Warnings are collected and reported by the caller.
+//Instance and net IDs follow the RTLIL order, or the locality order
+//(see snl_order.h). Net components are listed by instance ID.
+//Constant bits of instance connections and of module connections are
+//connected to one logic-0 and one logic-1 net, dumped after the other
+//nets when connected.
+//instanceCells, when set, gets the cell of each instance in instance ID
+//order.
+std::unique_ptr<capnp::MallocMessageBuilder> dumpDesignImplementation(
+  RTLIL::Module* userModule,
+  size_t designID,
+  const Models& models,
+  const DumpOptions& options,
+  Warnings& warnings,
+  DesignStats& stats,
+  std::vector<const RTLIL::Cell*>* instanceCells = nullptr) {
+  auto order = options.order_;
+  auto start = SNLStats::Clock::now();
+  auto userModel = models.find(userModule->name);
+  assert(userModel);
+  const Terms& terms = userModel->terms_;
+  //collect all nets: bus and scalar
+  Nets nets;
+  NetBitIndex netBitIndex;
+  size_t bitsSize = 0;
+  nets.reserve(userModule->wires().size());
+  for (auto wire: userModule->wires()) {
+    collectWire(wire, nets, netBitIndex, bitsSize); 
+  }
+  ConstantBits constantBits;
+  constantBits.const0_ = bitsSize++;
+  constantBits.const1_ = bitsSize++;
+  constantBits.tieXZ_ = options.tieXZ_;
+  netBitIndex.mergeAliases(userModule, bitsSize, constantBits);
+  auto netsCollected = SNLStats::Clock::now();
+  stats.collectNets_ += SNLStats::getSeconds(start, netsCollected);
+
+  //filter special instances (for instance $print)
+  using Instance = std::pair<const RTLIL::Cell*, const Model*>;
+  std::vector<Instance> instances;
+  size_t instancesSize = 0;
+  for (auto cell: userModule->cells()) {
+    auto model = models.find(cell);
+    if (model) {
+      ++instancesSize;
+    } else if (not YosysCellPrimitives::isIgnored(cell)) {
+      warnings.push_back(stringf("Model type %s not found in map for cell %s",
+        cell->type.c_str(), cell->name.c_str()));
     }
+    instances.push_back(Instance(cell, model));
+  }
 
-    if (instancesSize > 0) {
-      auto instances = design.initInstances(instancesSize);
-      size_t instanceID = 0;
-      size_t autoNameID = 0;
-      for (auto cell: userModule->cells()) {
-        std::string name;
-        //rename instance
-        auto yosysName = cell->name.c_str();
-        if (*yosysName == '$') {
-          name = '_' + std::to_string(autoNameID++) + '_';
-        } else {
-          name = getName(cell->name);
-        }
-        auto modelIt = models.find(getName(cell->type));
-        if (modelIt == models.end()) {
+  //Calls visit(flat bit, component) for every design term bit
+  //and every instance term bit connected to a net
+  auto visitComponents = [&](auto&& visit) {
+    for (const auto& net: nets) {
+      auto wire = net.wire_;
+      if (wire->port_id == 0) {
+        continue;
+      }
+      auto tid = terms[wire->port_id];
+      assert(tid != -1);
+      bool isBus = wire->width != 1;
+      for (int offset = 0; offset < wire->width; ++offset) {
+        visit(netBitIndex.resolve(net.firstBit_ + offset), Component {
+          Component::DesignTerm, tid,
+          isBus ? getHDLBit(wire, offset) : Component::NoBit});
+      }
+    }
+    int instanceID = 0;
+    for (auto [cell, model]: instances) {
+      if (not model) {
+        continue;
+      }
+      for (auto& conn: cell->connections()) {
+        if (conn.second.size() == 0) {
+          //not a port of generated primitives
           continue;
         }
-        //
-#if SNL_YOSYS_PLUGIN_DEBUG
-        std::cerr << "Dumping cell/instance implementation: " << getName(cell->name) << std::endl;
-        std::cerr << "Renamed to: " << name << std::endl;
-#endif
-        YosysDebug::print(cell, 0);
-        auto instance = instances[instanceID];
-        instance.setId(instanceID);
-        instance.setName(name);
-        auto modelReferenceBuilder = instance.initModelReference();
-        modelReferenceBuilder.setDbID(1);
-        const auto& model = modelIt->second;
-        auto libraryID = model.libraryID_;
-        auto modelID = model.designID_;
-        modelReferenceBuilder.setLibraryID(libraryID);
-        modelReferenceBuilder.setDesignID(modelID);
-        dumpInstanceParameters(instance, cell);
-        auto module = ydesign->module(cell->type);
-
-        for (auto& conn: cell->connections()) {
-#if SNL_YOSYS_PLUGIN_DEBUG
-          YosysDebug::print(conn.first, conn.second, 0);
-#endif
-          //Find net
-          auto ss = conn.second;
-          if (ss.size() != 1) {
-            //FIXME !!
+        //Find inst term
+        auto port = model->getPort(conn.first);
+        assert(port);
+        auto tid = port->termID_;
+        bool isBus = port->width_ != 1;
+        assert(conn.second.size() == port->width_);
+        //Resolve all bits, one net lookup per chunk
+        int termOffset = 0;
+        for (const auto& chunk: conn.second.chunks()) {
+          if (not chunk.wire) {
+            for (int i=0; i<chunk.width; ++i, ++termOffset) {
+              size_t constantBit;
+              if (constantBits.get(chunk.data[i], constantBit)) {
+                visit(constantBit, Component {
+                  instanceID, tid, isBus ? getHDLBit(*port, termOffset) : Component::NoBit});
+              }
+            }
             continue;
           }
-          assert(ss.size() == 1);
-          auto bit = ss.bits()[0];
-          auto w = bit.wire;
-          if (not w) {
-            //FIXME: constants
-            continue;
+          auto firstBit = netBitIndex.getFirstBit(chunk.wire) + chunk.offset;
+          for (int i=0; i<chunk.width; ++i, ++termOffset) {
+            visit(netBitIndex.resolve(firstBit + i), Component {
+              instanceID, tid, isBus ? getHDLBit(*port, termOffset) : Component::NoBit});
           }
-          auto offset = bit.offset;
-          //Find w in map
-          auto nit = nets.find(w);
-          assert(nit != nets.end());
-#if SNL_YOSYS_PLUGIN_DEBUG
-          std::cerr << "Found: " << std::endl;
-          YosysDebug::print(w, 0);
+        }
+      }
+      ++instanceID;
+    }
+  };
+  //-order: instances are renumbered before the connectivity is built,
+  //their components are then visited in the new order. Nets follow
+  //their first instance, firstInstances giving it per bit.
+  std::vector<size_t> firstInstances;
+  if (order != SNLOrder::Type::Default) {
+    auto orderStart = SNLStats::Clock::now();
+    std::vector<Instance> modeled;
+    std::vector<Instance> unmodeled;
+    for (const auto& instance: instances) {
+      (instance.second ? modeled : unmodeled).push_back(instance);
+    }
+    SNLOrder::Graph graph;
+    graph.offsets_.assign(modeled.size() + 1, 0);
+    std::vector<size_t> seedBits;
+    visitComponents([&](size_t bit, const Component& component) {
+      if (component.isTerm()) {
+        seedBits.push_back(bit);
+      } else {
+        graph.bits_.push_back(bit);
+        ++graph.offsets_[component.instanceID_ + 1];
+      }
+    });
+    for (size_t i = 0; i < modeled.size(); ++i) {
+      graph.offsets_[i + 1] += graph.offsets_[i];
+    }
+    std::vector<size_t> instanceOrder;
+    if (order == SNLOrder::Type::Name) {
+      //flattened names group the instances of a hierarchy
+      instanceOrder.resize(modeled.size());
+      std::iota(instanceOrder.begin(), instanceOrder.end(), 0);
+      std::stable_sort(instanceOrder.begin(), instanceOrder.end(), [&](size_t a, size_t b) {
+        return strcmp(modeled[a].first->name.c_str(), modeled[b].first->name.c_str()) < 0;
+      });
+    } else {
+      instanceOrder = SNLOrder::getOrder(order, graph, bitsSize, seedBits);
+    }
+    firstInstances.assign(bitsSize, std::numeric_limits<size_t>::max());
+    instances.clear();
+    for (size_t instanceID = 0; instanceID < instanceOrder.size(); ++instanceID) {
+      auto i = instanceOrder[instanceID];
+      for (size_t k = graph.offsets_[i]; k < graph.offsets_[i + 1]; ++k) {
+        auto& firstInstance = firstInstances[graph.bits_[k]];
+        firstInstance = std::min(firstInstance, instanceID);
+      }
+      instances.push_back(modeled[i]);
+    }
+    instances.insert(instances.end(), unmodeled.begin(), unmodeled.end());
+    stats.order_ += SNLStats::getSeconds(orderStart, SNLStats::Clock::now());
+  }
+
+  Connectivity connectivity(bitsSize);
+  visitComponents([&](size_t bit, const Component&) {
+    connectivity.count(bit);
+  });
+  connectivity.allocate();
+  visitComponents([&](size_t bit, const Component& component) {
+    connectivity.add(bit, component);
+  });
+  auto connectionsResolved = SNLStats::Clock::now();
+  stats.resolveConnections_ += SNLStats::getSeconds(netsCollected, connectionsResolved);
+
+  //nets whose bits all alias bits of other nets are not dumped, and
+  //their names are lost. The aliased bits of partly aliased buses are
+  //dumped without components, which all go to the representative bits.
+  std::vector<const Net*> dumpedNets;
+  dumpedNets.reserve(nets.size());
+  for (const auto& net: nets) {
+    for (int offset = 0; offset < net.wire_->width; ++offset) {
+      if (netBitIndex.isRepresentative(net.firstBit_ + offset)) {
+        dumpedNets.push_back(&net);
+        break;
+      }
+    }
+  }
+  if (order == SNLOrder::Type::Name) {
+    std::stable_sort(dumpedNets.begin(), dumpedNets.end(), [](const Net* a, const Net* b) {
+      return strcmp(a->wire_->name.c_str(), b->wire_->name.c_str()) < 0;
+    });
+  } else if (order != SNLOrder::Type::Default) {
+    //nets connected to no instance last
+    auto getFirstInstance = [&](const Net* net) {
+      size_t firstInstance = std::numeric_limits<size_t>::max();
+      for (int offset = 0; offset < net->wire_->width; ++offset) {
+        firstInstance = std::min(firstInstance,
+          firstInstances[netBitIndex.resolve(net->firstBit_ + offset)]);
+      }
+      return firstInstance;
+    };
+    std::vector<std::pair<size_t, const Net*>> keyedNets;
+    keyedNets.reserve(dumpedNets.size());
+    for (auto net: dumpedNets) {
+      keyedNets.emplace_back(getFirstInstance(net), net);
+    }
+    std::stable_sort(keyedNets.begin(), keyedNets.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (size_t i = 0; i < keyedNets.size(); ++i) {
+      dumpedNets[i] = keyedNets[i].second;
+    }
+  }
+
+  //shared constant nets, only when connected
+  using ConstantNet = std::pair<size_t, DBImplementation::NetType>;
+  std::vector<ConstantNet> constantNets;
+  for (const auto& constantNet: {
+    ConstantNet(constantBits.const0_, DBImplementation::NetType::ASSIGN0),
+    ConstantNet(constantBits.const1_, DBImplementation::NetType::ASSIGN1)}) {
+    if (connectivity.getFanout(constantNet.first) > 0) {
+      constantNets.push_back(constantNet);
+    }
+  }
+  size_t netsSize = dumpedNets.size() + constantNets.size();
+
+  //counting pass: words of the message
+  size_t words = 1 + capnp::sizeInWords<DesignImplementation>();
+  if (instancesSize > 0) {
+    words += 1 + instancesSize * (capnp::sizeInWords<DesignImplementation::Instance>()
+      + capnp::sizeInWords<DesignReference>());
+    for (auto [cell, model]: instances) {
+      if (not model) {
+        continue;
+      }
+      words += getTextWords(strlen(cell->name.c_str()));
+      if (not cell->parameters.empty()) {
+        words += 1;
+        for (const auto& parameter: cell->parameters) {
+          words += capnp::sizeInWords<DesignImplementation::Instance::InstParameter>()
+            + getTextWords(strlen(parameter.first.c_str()))
+            //hexadecimal values are a quarter of the bits, strings an eighth
+            + getTextWords(parameter.second.size() / 4 + 16);
+        }
+      }
+    }
+  }
+  if (netsSize > 0) {
+    words += 1 + netsSize * capnp::sizeInWords<DesignImplementation::Net>()
+      + constantNets.size() * capnp::sizeInWords<DesignImplementation::ScalarNet>();
+    for (auto net: dumpedNets) {
+      words += getTextWords(strlen(net->wire_->name.c_str()));
+      if (net->isBus_) {
+        words += capnp::sizeInWords<DesignImplementation::BusNet>()
+          + 1 + net->wire_->width * capnp::sizeInWords<DesignImplementation::BusNetBit>();
+      } else {
+        words += capnp::sizeInWords<DesignImplementation::ScalarNet>();
+      }
+    }
+  }
+  //one list per connected bit
+  words += bitsSize + connectivity.getComponentsSize()
+    * (capnp::sizeInWords<DBImplementation::NetComponentReference>()
+      + capnp::sizeInWords<DBImplementation::NetComponentReference::InstTermReference>());
+  auto message = std::make_unique<capnp::MallocMessageBuilder>(getFirstSegmentWords(words));
+  auto design = message->initRoot<DesignImplementation>();
+  design.setId(designID);
+
+  if (instancesSize > 0) {
+    auto dumpInstances = design.initInstances(instancesSize);
+    size_t instanceID = 0;
+    size_t autoNameID = 0;
+    for (auto [cell, model]: instances) {
+      std::string name;
+      //rename instance
+      auto yosysName = cell->name.c_str();
+      if (*yosysName == '$') {
+        name = '_' + std::to_string(autoNameID++) + '_';
+      } else {
+        name = getName(cell->name);
+      }
+      if (not model) {
+        continue;
+      }
+      SNL_TRACE(Instances, userModule->name.c_str(), cell->name.c_str(),
+        "instance " << instanceID << " " << name << " (" << cell->name.c_str() << ") of "
+        << cell->type.c_str() << " -> " << model->libraryID_ << ":" << model->designID_
+        << ", " << cell->parameters.size() << " parameters");
+      auto instance = dumpInstances[instanceID];
+      instance.setId(instanceID);
+      instance.setName(name);
+      auto modelReferenceBuilder = instance.initModelReference();
+      modelReferenceBuilder.setDbID(1);
+      auto libraryID = model->libraryID_;
+      auto modelID = model->designID_;
+      modelReferenceBuilder.setLibraryID(libraryID);
+      modelReferenceBuilder.setDesignID(modelID);
+      dumpInstanceParameters(instance, cell);
+      if (instanceCells) {
+        instanceCells->push_back(cell);
+      }
+      ++instanceID;
+    }
+  }
+
+  if (netsSize > 0) {
+    auto dumpNets = design.initNets(netsSize);
+    size_t netID = 0;
+    size_t autoNameID = 0;
+    for (auto dumpedNet: dumpedNets) {
+      const auto& net = *dumpedNet;
+      std::string name;
+      //rename net or name net
+      auto wire = net.wire_;
+      auto yosysName = wire->name.c_str();
+      if (*yosysName == '$') {
+        name = '_' + std::to_string(autoNameID++) + '_';
+      } else {
+        name = getName(wire->name);
+      }
+      //
+      auto dumpNet = dumpNets[netID];
+      if (net.isBus_) {
+        dumpBusNet(dumpNet, name, net, connectivity, netID);
+      } else {
+        dumpScalarNet(dumpNet, name, net, connectivity, netID);
+      }
+      ++netID;
+    }
+    for (const auto& [bit, type]: constantNets) {
+      auto dumpNet = dumpNets[netID];
+      dumpConstantNet(dumpNet, userModule, type, connectivity, bit, netID);
+      ++netID;
+    }
+  }
+  stats.instances_ += instancesSize;
+  stats.nets_ += netsSize;
+  //wire bits only: the constant bits follow them
+  stats.netBits_ += constantBits.const0_;
+  stats.components_ += connectivity.getComponentsSize();
+  stats.maxFanout_ = std::max(stats.maxFanout_, connectivity.getMaxFanout());
+  stats.build_ += SNLStats::getSeconds(connectionsResolved, SNLStats::Clock::now());
+  return message;
+}
+
+//Design implementation built by a worker or loaded from the cache
+struct DesignMessage {
+  std::unique_ptr<capnp::MallocMessageBuilder>  built_   {};
+  std::unique_ptr<SNLCache::Fragment>           cached_  {};
+  //models of the instances of the cached design, by instance ID
+  std::vector<const Model*>                     models_  {};
+  DesignImplementation::Reader getDesign() {
+    if (cached_) {
+      return cached_->getRoot<DesignImplementation>();
+    }
+    return built_->getRoot<DesignImplementation>().asReader();
+  }
+  size_t getSizeInWords() const {
+    if (cached_) {
+      return cached_->getSizeInWords();
+    }
+    return built_->sizeInWords();
+  }
+};
+using DesignMessages = std::vector<DesignMessage>;
+using ModuleVector = std::vector<RTLIL::Module*>;
+
+//-index: each design of designMessages, with IDs from first, is copied in
+//a standalone DBImplementation message (library 1 and this design only).
+//Messages are serialized, and compressed, in parallel, then written one
+//after the other in implementationPath, and designsIndex gets one line
+//per design:
+//<library ID> <design ID> <file name> <offset> <length> <instances> <nets>
+//so that a reader decodes a single design from its byte range.
+void dumpIndexedChunk(
+  DesignMessages& designMessages,
+  size_t first,
+  const std::filesystem::path& implementationPath,
+  std::ostream& designsIndex,
+  const DumpOptions& options) {
+  size_t designsSize = designMessages.size();
+  using Bytes = std::vector<uint8_t>;
+  auto serializedDesigns = std::make_shared<std::vector<Bytes>>(designsSize);
+  std::vector<std::pair<size_t, size_t>> counts(designsSize);
+  {
+    SNLStats::Timer timer(options.stats_, "merge_implementation");
+    try {
+      parallelFor(designsSize, options.jobs_, [&](size_t i) {
+        auto design = designMessages[i].getDesign();
+        counts[i] = {design.getInstances().size(), design.getNets().size()};
+        size_t words = 4 + capnp::sizeInWords<DBImplementation>()
+          + capnp::sizeInWords<DBImplementation::LibraryImplementation>()
+          + capnp::sizeInWords<DesignImplementation>()
+          + designMessages[i].getSizeInWords();
+        capnp::MallocMessageBuilder message(getFirstSegmentWords(words));
+        DBImplementation::Builder db = message.initRoot<DBImplementation>();
+        db.setId(1);
+        auto library = db.initLibraryImplementations(1)[0];
+        library.setId(1);
+        auto designs = library.initSnlDesignImplementations(1);
+        designs.setWithCaveats(0, design);
+        designs[0].setId(first+i);
+        if (designMessages[i].cached_) {
+          setModelReferences(designs[0], designMessages[i].models_);
+        }
+        designMessages[i] = DesignMessage();
+
+        kj::VectorOutputStream stream;
+        if (options.packed_) {
+          capnp::writePackedMessage(stream, message);
+        } else {
+          capnp::writeMessage(stream, message);
+        }
+        auto bytes = stream.getArray();
+#ifdef SNL_WITH_ZSTD
+        if (options.compress_) {
+          //designs are compressed in parallel, the frames of each serially
+          (*serializedDesigns)[i] = SNLFrames::compress(
+            bytes.begin(), bytes.size(), options.frameSize_, SNLFrames::DefaultLevel, 1);
+          return;
+        }
 #endif
-          auto& n = nit->second;
-          assert((int)n.bits_.size() == w->width);
-          auto pw = module->wire(conn.first);
-          assert(pw);
-
-          //Find inst term
-          const auto& terms = model.terms_;
-          auto it = terms.find(pw->port_id);
-          assert(it != terms.end());
-          auto tid = it->second;
-          if (n.bits_.size() > 1) {
-            n.bits_[offset].components_.emplace_back(Component(instanceID, tid, true, offset));
-          } else {
-            n.bits_.back().components_.emplace_back(Component(instanceID, tid, false, 0));
-          }
-          std::cerr << "tid: " << tid << std::endl;
-			  }
-        ++instanceID;
-      }
-
-      if (not nets.empty()) {
-        auto dumpNets = design.initNets(nets.size());
-        size_t netID = 0;
-        size_t autoNameID = 0;
-        for (auto& [wire, net]: nets) {
-          std::string name;
-          //rename net or name net
-          auto yosysName = wire->name.c_str();
-          if (*yosysName == '$') {
-            name = '_' + std::to_string(autoNameID++) + '_';
-          } else {
-            name = getName(wire->name);
+        (*serializedDesigns)[i].assign(bytes.begin(), bytes.end());
+      });
+    } catch (const std::exception& e) {
+      log_error("Cannot serialize %s: %s\n", implementationPath.c_str(), e.what());
+    }
+  }
+
+  auto fileName = implementationPath.filename().string();
+  size_t offset = 0;
+  for (size_t i = 0; i < designsSize; ++i) {
+    auto length = (*serializedDesigns)[i].size();
+    designsIndex << 1
+      << " " << first+i
+      << " " << fileName
+      << " " << offset
+      << " " << length
+      << " " << counts[i].first
+      << " " << counts[i].second
+      << std::endl;
+    offset += length;
+  }
+  options.writer_->write(implementationPath, [serializedDesigns](int fd) {
+    for (const auto& bytes: *serializedDesigns) {
+      SNLWriter::writeAll(fd, bytes.data(), bytes.size());
+    }
+  }, offset);
+}
+
+//Builds designs [first, last) of modules and writes them as one
+//DBImplementation message in implementationPath, or with a designsIndex
+//as one message per design (see dumpIndexedChunk).
+//Every design implementation is built in its own message on up to
+//options.jobs_ threads, then copied in design order into the final message.
+//The serial path (jobs == 1) goes through the same steps so the output
+//does not depend on the number of jobs.
+//With a cache, unchanged designs are loaded instead of built, and built
+//designs are stored.
+void dumpImplementationChunk(
+  const ModuleVector& modules,
+  size_t first,
+  size_t last,
+  const std::filesystem::path& implementationPath,
+  const Models& models,
+  std::ostream* designsIndex,
+  const DumpOptions& options) {
+  size_t designsSize = last - first;
+  DesignMessages designMessages(designsSize);
+  std::vector<Warnings> warnings(designsSize);
+  std::vector<DesignStats> designStats(designsSize);
+  {
+    SNLStats::Timer timer(options.stats_, "implementation");
+    try {
+      parallelFor(designsSize, options.jobs_, [&](size_t i) {
+        auto module = modules[first+i];
+        auto cache = options.cache_;
+        YosysHash::Key key;
+        if (cache) {
+          key = getImplementationKey(module, models, options);
+          auto fragment = cache->load(key, "implementation");
+          if (fragment and loadDesignRecord(
+            *cache, key, *fragment, module, models, designStats[i], designMessages[i].models_)) {
+            //replay the warnings of the build
+            for (auto cell: module->cells()) {
+              if (not models.find(cell) and not YosysCellPrimitives::isIgnored(cell)) {
+                warnings[i].push_back(stringf("Model type %s not found in map for cell %s",
+                  cell->type.c_str(), cell->name.c_str()));
+              }
+            }
+            designMessages[i].cached_ = std::move(fragment);
+            ++designStats[i].cacheHits_;
+            return;
           }
-          //
-          auto dumpNet = dumpNets[netID];
-          if (net.isBus_) {
-            dumpBusNet(dumpNet, name, net, netID);
-          } else {
-            dumpScalarNet(dumpNet, name, net, netID);
+        }
+        std::vector<const RTLIL::Cell*> instanceCells;
+        auto designMessage = dumpDesignImplementation(
+          module, first+i, models, options, warnings[i], designStats[i],
+          cache ? &instanceCells : nullptr);
+        if (cache) {
+          if (not cache->store(key, "implementation", *designMessage)) {
+            warnings[i].push_back(stringf("Cannot write cache entry %s.implementation", key.c_str()));
+          } else if (not storeDesignRecord(*cache, key, module, instanceCells, designStats[i])) {
+            warnings[i].push_back(stringf("Cannot write cache entry %s.record", key.c_str()));
           }
-          ++netID;
+          ++designStats[i].cacheMisses_;
         }
+        designMessages[i].built_ = std::move(designMessage);
+      });
+    } catch (const std::exception& e) {
+      log_error("Cannot build %s: %s\n", implementationPath.c_str(), e.what());
+    }
+  }
+  for (const auto& designWarnings: warnings) {
+    for (const auto& warning: designWarnings) {
+      log_warning("%s\n", warning.c_str());
+    }
+  }
+  if (auto stats = options.stats_) {
+    //per design phases are summed over all workers
+    for (const auto& designStat: designStats) {
+      stats->addPhase("collect_nets_cumulated", designStat.collectNets_);
+      stats->addPhase("resolve_connections_cumulated", designStat.resolveConnections_);
+      stats->addPhase("build_implementation_cumulated", designStat.build_);
+      if (options.order_ != SNLOrder::Type::Default) {
+        stats->addPhase("order_cumulated", designStat.order_);
+      }
+      stats->addCounter("instances", designStat.instances_);
+      stats->addCounter("nets", designStat.nets_);
+      stats->addCounter("net_bits", designStat.netBits_);
+      stats->addCounter("components", designStat.components_);
+      stats->maxCounter("max_fanout", designStat.maxFanout_);
+      if (options.cache_) {
+        stats->addCounter("cache_hits", designStat.cacheHits_);
+        stats->addCounter("cache_misses", designStat.cacheMisses_);
+      }
+    }
+  }
+
+  if (designsIndex) {
+    dumpIndexedChunk(designMessages, first, implementationPath, *designsIndex, options);
+    return;
+  }
+
+  //designs are copied as they are: the message is their sum
+  size_t words = 4 + capnp::sizeInWords<DBImplementation>()
+    + capnp::sizeInWords<DBImplementation::LibraryImplementation>()
+    + designsSize * capnp::sizeInWords<DesignImplementation>();
+  for (const auto& designMessage: designMessages) {
+    words += designMessage.getSizeInWords();
+  }
+  auto message = std::make_unique<capnp::MallocMessageBuilder>(getFirstSegmentWords(words));
+  {
+    SNLStats::Timer timer(options.stats_, "merge_implementation");
+    DBImplementation::Builder db = message->initRoot<DBImplementation>();
+    db.setId(1);
+    auto libraries = db.initLibraryImplementations(1);
+    auto library = libraries[0];
+    library.setId(1); 
+
+    auto designs = library.initSnlDesignImplementations(designsSize);
+    try {
+      for (size_t i = 0; i < designsSize; ++i) {
+        designs.setWithCaveats(i, designMessages[i].getDesign());
+        //cached designs may have been built with other IDs
+        designs[i].setId(first+i);
+        if (designMessages[i].cached_) {
+          setModelReferences(designs[i], designMessages[i].models_);
+        }
+        //release memory as soon as the design is copied
+        designMessages[i] = DesignMessage();
       }
+    } catch (const std::exception& e) {
+      //kj exceptions of malformed cached designs included
+      log_error("Cannot merge %s: %s\n", implementationPath.c_str(), e.what());
     }
   }
-  int fd = open(
-    implementationPath.c_str(),
-    O_CREAT | O_WRONLY,
-    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-  writePackedMessageToFd(fd, message);
-  close(fd);
+
+  writeMessage(implementationPath, std::move(message), options);
 }
 
-void dumpManifest(const std::filesystem::path& dir) {
-  std::filesystem::path manifestPath(dir/"snl.mf");
-  std::ofstream stream;
-  stream.open(manifestPath, std::ofstream::out);
+//Without splitting, all designs go to db_implementation.snl.
+//With a split size of N, designs are written N at a time in
+//db_implementation.<chunk>.snl, each chunk message being freed once written,
+//and db_implementation.idx lists, one chunk per line:
+//<file name> <library ID> <first design ID> <designs count>
+//The next chunk is built while the previous one is written: memory holds
+//about two chunks.
+//With -index, the files hold one message per design, located by
+//db_designs.idx (see dumpIndexedChunk).
+void dumpImplementation(
+  const Modules& userModules,
+  const std::filesystem::path& dir,
+  const Models& models,
+  const DumpOptions& options) {
+  ModuleVector modules(userModules.begin(), userModules.end());
+  std::ostringstream designsIndex;
+  auto designsIndexStream = options.indexed_ ? &designsIndex : nullptr;
+  if (not options.writer_->isStream()) {
+    //readers would follow the indexes of a previous export
+    std::error_code error;
+    if (options.splitSize_ == 0) {
+      std::filesystem::remove(dir/"db_implementation.idx", error);
+    }
+    if (not options.indexed_) {
+      std::filesystem::remove(dir/"db_designs.idx", error);
+    }
+  }
+  if (options.splitSize_ == 0) {
+    dumpImplementationChunk(
+      modules, 0, modules.size(),
+      dir/"db_implementation.snl", models, designsIndexStream, options);
+  } else {
+    std::ostringstream index;
+    size_t chunkID = 0;
+    for (size_t first = 0; first < modules.size(); first += options.splitSize_) {
+      size_t last = std::min(first + options.splitSize_, modules.size());
+      auto fileName = "db_implementation." + std::to_string(chunkID++) + ".snl";
+      dumpImplementationChunk(
+        modules, first, last, dir/fileName, models, designsIndexStream, options);
+      index << fileName
+        << " " << 1
+        << " " << first
+        << " " << last - first
+        << std::endl;
+    }
+    options.writer_->writeText(dir/"db_implementation.idx", index.str());
+  }
+  if (options.indexed_) {
+    options.writer_->writeText(dir/"db_designs.idx", designsIndex.str());
+  }
+}
+
+//Manifest lines:
+//V <major> <minor> <revision>
+//E <packed|unpacked>: capnp encoding of the .snl messages
+//C <none|zstd <frame size>>: compression of the .snl files
+//L <merged|designs>: one message per implementation file, or one message
+//per design located by db_designs.idx (-index)
+//Written last, once all the other files are in place: a directory
+//without snl.mf is an incomplete export. Streams start with it.
+void dumpManifest(const std::filesystem::path& dir, const DumpOptions& options) {
+  std::ostringstream stream;
   stream << "V"
     << " " << 0
     << " " << 0
     << " " << 1
     << std::endl;
+  stream << "E"
+    << " " << (options.packed_ ? "packed" : "unpacked")
+    << std::endl;
+  stream << "C";
+  if (options.compress_) {
+    stream << " zstd " << options.frameSize_;
+  } else {
+    stream << " none";
+  }
+  stream << std::endl;
+  stream << "L"
+    << " " << (options.indexed_ ? "designs" : "merged")
+    << std::endl;
+  options.writer_->writeText(dir/"snl.mf", stream.str());
+}
+
+//Collects the user modules to export, the selected ones or the -top
+//module, with the user modules and the primitives they transitively
+//instantiate. Primitives that are already models (from a primitives
+//library) are not collected.
+//Internal cells ($and, $dff...) get the generated primitive of their
+//variant from cellPrimitives.
+
+//Cells are scanned one instantiation level at a time on options.jobs_
+//threads, each module collecting its own dependencies that are then
+//merged in the sorted sets, so only the exported part of the design is
+//visited.
+void discoverModules(
+  RTLIL::Design* design,
+  const Models& models,
+  YosysCellPrimitives& cellPrimitives,
+  Modules& primitiveModules,
+  Modules& userModules,
+  const DumpOptions& options) {
+  dict<RTLIL::IdString, RTLIL::Module*> blackboxes;
+  Modules roots;
+  for (auto module: design->modules()) {
+    if (module->get_blackbox_attribute()) {
+      blackboxes[module->name] = module;
+    } else if (options.top_ ? module == options.top_ : design->selected_module(module)) {
+      //partially selected modules are exported whole
+      roots.insert(module);
+    }
+  }
+  //first lookups from this thread, see Models::freeze
+  blackboxes.count(RTLIL::IdString());
+  design->module(RTLIL::IdString());
+  models.freeze();
+
+  userModules.insert(roots.begin(), roots.end());
+  ModuleVector modules(roots.begin(), roots.end());
+  while (not modules.empty()) {
+    std::vector<pool<RTLIL::Module*>> primitives(modules.size());
+    std::vector<pool<RTLIL::Module*>> instantiated(modules.size());
+    std::vector<std::vector<const RTLIL::Cell*>> unknownCells(modules.size());
+    parallelFor(modules.size(), options.jobs_, [&](size_t i) {
+      for (auto cell: modules[i]->cells()) {
+        if (models.find(cell->type)) {
+          continue;
+        }
+        auto it = blackboxes.find(cell->type);
+        if (it != blackboxes.end()) {
+          primitives[i].insert(it->second);
+        } else if (auto module = design->module(cell->type)) {
+          instantiated[i].insert(module);
+        } else {
+          unknownCells[i].push_back(cell);
+        }
+      }
+    });
+
+    //next level: the modules instantiated for the first time
+    Modules next;
+    for (size_t i = 0; i < modules.size(); ++i) {
+      primitiveModules.insert(primitives[i].begin(), primitives[i].end());
+      for (auto module: instantiated[i]) {
+        if (userModules.insert(module).second) {
+          next.insert(module);
+        }
+      }
+      for (auto cell: unknownCells[i]) {
+        if (YosysCellPrimitives::isIgnored(cell)) {
+          continue;
+        }
+        if (auto primitive = cellPrimitives.add(cell)) {
+          if (design->module(primitive->name)) {
+            log_error("Primitive %s generated for cell %s of type %s has the name of a module of the design.\n",
+              log_id(primitive->name), log_id(cell->name), log_id(cell->type));
+          }
+          if (not models.find(primitive->name)) {
+            primitiveModules.insert(primitive);
+          }
+        } else {
+          log_warning("Cannot find module %s of cell %s.\n", log_id(cell->type), log_id(cell->name));
+        }
+      }
+    }
+    modules.assign(next.begin(), next.end());
+  }
 }
 
 //}
 
 struct SNLBackend: public Backend {
-  SNLBackend() : Backend("snl", "write design to Naja SNL netlist file") {}
+  SNLBackend(
+    const char* name = "naja-if",
+    const char* description = "write design to Naja SNL netlist file"):
+    Backend(name, description) {}
 	void execute(std::ostream *&f, std::string filename, std::vector<std::string> args, RTLIL::Design *design) override {
     log_header(design, "Executing Naja SNL backend.\n");
 
+    DumpOptions options;
+    SNLStats stats;
+    std::unique_ptr<SNLCache> cache;
+    std::string primitivesLibraryPath;
+    std::string writePrimitivesLibraryPath;
+    std::string streamTarget;
+    uint32_t traceCategories = 0;
+    std::string traceFilter;
+    size_t argidx;
+    for (argidx = 1; argidx < args.size(); argidx++) {
+      if (args[argidx] == "-j" && argidx+1 < args.size()) {
+        int value = atoi(args[++argidx].c_str());
+        if (value < 0) {
+          log_cmd_error("Invalid number of jobs: %d\n", value);
+        }
+        options.jobs_ = (value == 0) ? std::max(1u, std::thread::hardware_concurrency()) : value;
+        continue;
+      }
+      if (args[argidx] == "-split" && argidx+1 < args.size()) {
+        int value = atoi(args[++argidx].c_str());
+        if (value <= 0) {
+          log_cmd_error("Invalid split size: %d\n", value);
+        }
+        options.splitSize_ = value;
+        continue;
+      }
+      if (args[argidx] == "-stats") {
+        options.stats_ = &stats;
+        continue;
+      }
+      if (args[argidx] == "-dedup") {
+        options.dedup_ = true;
+        continue;
+      }
+      if (args[argidx] == "-unpacked") {
+        options.packed_ = false;
+        continue;
+      }
+      if (args[argidx] == "-compress" && argidx+1 < args.size()) {
+        auto codec = args[++argidx];
+        if (codec != "zstd") {
+          log_cmd_error("Unsupported compression: %s\n", codec.c_str());
+        }
+#ifndef SNL_WITH_ZSTD
+        log_cmd_error("Plugin built without zstd support.\n");
+#endif
+        options.compress_ = true;
+        continue;
+      }
+      if (args[argidx] == "-primitives-library" && argidx+1 < args.size()) {
+        primitivesLibraryPath = args[++argidx];
+        continue;
+      }
+      if (args[argidx] == "-write-primitives-library" && argidx+1 < args.size()) {
+        writePrimitivesLibraryPath = args[++argidx];
+        continue;
+      }
+      if (args[argidx] == "-cache" && argidx+1 < args.size()) {
+        cache = std::make_unique<SNLCache>(args[++argidx]);
+        options.cache_ = cache.get();
+        continue;
+      }
+      if (args[argidx] == "-stream" && argidx+1 < args.size()) {
+        streamTarget = args[++argidx];
+        continue;
+      }
+      if (args[argidx] == "-order" && argidx+1 < args.size()) {
+        if (not SNLOrder::parse(args[++argidx], options.order_)) {
+          log_cmd_error("Invalid order: %s (expected bfs, rcm or name)\n", args[argidx].c_str());
+        }
+        continue;
+      }
+      if (args[argidx] == "-tie-xz" && argidx+1 < args.size()) {
+        auto value = args[++argidx];
+        if (value != "0" and value != "1") {
+          log_cmd_error("Invalid x and z tie: %s (expected 0 or 1)\n", value.c_str());
+        }
+        options.tieXZ_ = value == "0" ? RTLIL::State::S0 : RTLIL::State::S1;
+        continue;
+      }
+      if (args[argidx] == "-index") {
+        options.indexed_ = true;
+        continue;
+      }
+      if (args[argidx] == "-trace" && argidx+1 < args.size()) {
+        if (not YosysTrace::parseCategories(args[++argidx], traceCategories)) {
+          log_cmd_error("Invalid trace categories: %s (expected %s)\n",
+            args[argidx].c_str(), YosysTrace::getCategoryNames().c_str());
+        }
+        continue;
+      }
+      if (args[argidx] == "-trace-filter" && argidx+1 < args.size()) {
+        traceFilter = args[++argidx];
+        continue;
+      }
+      if (args[argidx] == "-top" && argidx+1 < args.size()) {
+        auto name = args[++argidx];
+        options.top_ = design->module(RTLIL::escape_id(name));
+        if (not options.top_ or options.top_->get_blackbox_attribute()) {
+          log_cmd_error("Cannot find top module %s.\n", name.c_str());
+        }
+        continue;
+      }
+      if (args[argidx] == "-frame-size" && argidx+1 < args.size()) {
+        int value = atoi(args[++argidx].c_str());
+        if (value <= 0) {
+          log_cmd_error("Invalid frame size: %d\n", value);
+        }
+        options.frameSize_ = size_t(value) << 10;
+        continue;
+      }
+      break;
+    }
+    if (argidx < args.size()) {
+      cmd_error(args, argidx, "Unknown option or extra argument.");
+    }
+
+    YosysTrace::Scope trace(traceCategories, traceFilter);
+    bool streaming = not streamTarget.empty();
+    std::unique_ptr<SNLWriter> writer;
+    if (streaming) {
+      if (options.compress_ or options.indexed_ or not writePrimitivesLibraryPath.empty()) {
+        log_cmd_error("-stream cannot be combined with -compress, -index or -write-primitives-library.\n");
+      }
+      //stream items need their size before they are written
+      if (options.packed_) {
+        log_warning("-stream writes unpacked messages, packing is disabled.\n");
+        options.packed_ = false;
+      }
+      try {
+        writer = std::make_unique<SNLWriter>(SNLWriter::openStream(streamTarget));
+      } catch (const std::exception& e) {
+        log_cmd_error("Cannot open stream: %s\n", e.what());
+      }
+    } else {
+      writer = std::make_unique<SNLWriter>();
+    }
+    options.writer_ = writer.get();
+    //waits for the queued files and reports the write errors
+    auto finishWrites = [&]() {
+      auto report = writer->finish();
+      if (options.stats_) {
+        stats.addPhase("write", report.writeSeconds_);
+        stats.addPhase("write_wait", report.waitSeconds_);
+        if (not streaming) {
+          for (const auto& path: report.files_) {
+            stats.addFile(path);
+          }
+        }
+      }
+      for (size_t i = 1; i < report.errors_.size(); ++i) {
+        log_warning("%s\n", report.errors_[i].c_str());
+      }
+      if (not report.errors_.empty()) {
+        log_error("%s\n", report.errors_.front().c_str());
+      }
+    };
+
+    if (not writePrimitivesLibraryPath.empty()) {
+      dumpPrimitivesLibrary(design, writePrimitivesLibraryPath, options);
+      finishWrites();
+      return;
+    }
+
+    //names the stream items when streaming
     std::filesystem::path dir("snl");
-    std::filesystem::create_directory(dir);
-    dumpManifest(dir);
-    //SNLDumpManifest::dump(path);
+    if (streaming) {
+      //consumers need the manifest to decode the next items
+      dumpManifest(dir, options);
+    } else {
+      std::filesystem::create_directory(dir);
+      //the manifest of a previous export is removed first and written last
+      std::error_code error;
+      std::filesystem::remove(dir/"snl.mf", error);
+    }
+
+    Models models;
+    std::unique_ptr<PrimitivesLibrary> primitivesLibrary;
+    if (not primitivesLibraryPath.empty()) {
+      primitivesLibrary = std::make_unique<PrimitivesLibrary>(primitivesLibraryPath);
+      primitivesLibrary->addModels(models);
+      if (options.stats_) {
+        stats.addCounter("library_primitives", primitivesLibrary->getPrimitives().size());
+      }
+    }
 
     //First collect primitives
     Modules primitiveModules;
     Modules userModules;
-    for (auto module: design->modules()) {
-      if (module->get_blackbox_attribute()) {
-        continue;
-      }
-      userModules.insert(module);
-      for (auto cell: module->cells()) {
-        auto model = design->module(cell->type); 
-        if (not model) {
-          std::cerr << "cannot find module for "
-            << getName(cell->name)
-            << " of cell type: " << cell->type.c_str() << std::endl;
-        } else if (model->get_blackbox_attribute()) {
-          primitiveModules.insert(model);
-        }
+    auto discoveryStart = SNLStats::Clock::now();
+    YosysCellPrimitives cellPrimitives;
+    discoverModules(design, models, cellPrimitives, primitiveModules, userModules, options);
+    
+    if (options.stats_) {
+      stats.addPhase("discovery",
+        SNLStats::getSeconds(discoveryStart, SNLStats::Clock::now()));
+      stats.addCounter("modules", userModules.size());
+      stats.addCounter("primitives", primitiveModules.size());
+      stats.addCounter("cell_primitives", cellPrimitives.getVariantsSize());
+    }
+
+    ModuleAliases aliases;
+    if (options.dedup_) {
+      SNLStats::Timer timer(options.stats_, "dedup");
+      aliases = dedupModules(userModules, options);
+      if (options.stats_) {
+        stats.addCounter("deduplicated_modules", aliases.size());
       }
     }
     
-    Models models;
-    dumpInterface(primitiveModules, userModules, dir/"db_interface.snl", models);
-    dumpImplementation(design, userModules, dir/"db_implementation.snl", models);
+    dumpInterface(primitivesLibrary.get(), primitiveModules, userModules,
+      dir/"db_interface.snl", models, options);
+    addModelAliases(aliases, models);
+    for (const auto& [cell, primitive]: cellPrimitives.getCells()) {
+      models.addCell(cell, primitive->name);
+    }
+    models.freeze();
+    dumpImplementation(userModules, dir, models, options);
+    if (streaming) {
+      writer->writeEnd();
+      finishWrites();
+    } else {
+      finishWrites();
+      dumpManifest(dir, options);
+      finishWrites();
+    }
+    if (options.stats_) {
+      //with -stream, next to the stream rather than in a snl directory
+      auto statsPath = streaming ? std::filesystem::path("snl_stats.json") : dir/"snl_stats.json";
+      stats.write(statsPath);
+      //read by snl_bench
+      design->scratchpad_set_string("write_naja-if.stats", statsPath.string());
+    }
   }
 
 	void help() override
 	{
 		log("\n");
-		log("    snl_backend [options]\n");
+		log("    write_naja-if [options]\n");
+		log("\n");
+		log("Write the design to the Naja SNL interchange format in the snl directory.\n");
+		log("Only the selected modules, partially selected ones included, are written\n");
+		log("with the modules and primitives they instantiate, directly or not.\n");
+		log("\n");
+		log("Wires aliased by module connections (assign) are merged into one net,\n");
+		log("named after a port or a public wire of the group. The names of the\n");
+		log("other wires are lost: a wire whose bits all alias other bits is not\n");
+		log("written, and the aliased bits of a partly aliased bus are written\n");
+		log("unconnected. Wire bits assigned 0 or 1 likewise alias the constant\n");
+		log("nets of their design (see -tie-xz).\n");
+		log("\n");
+		log("Yosys internal cells ($and, $dff, $mux...) are written as instances of\n");
+		log("generated primitives, one per variant of a cell type: its port widths\n");
+		log("and *_SIGNED parameters, for instance yosys_add_A_8s_B_8s_Y_9. Coarse\n");
+		log("grained designs are written without a techmap to gates.\n");
+		log("A design module with the name of a generated primitive is an error.\n");
+		log("Cells without netlist meaning ($print, $check, $scopeinfo, formal\n");
+		log("properties and specify timing cells) are not written.\n");
+		log("\n");
+		log("Files are written in the background while the next one is built, each\n");
+		log("one atomically. snl.mf is written last: a directory without snl.mf\n");
+		log("holds an incomplete export.\n");
+		log("\n");
+		log("    -top <module>\n");
+		log("        write module and the modules and primitives it instantiates,\n");
+		log("        directly or not, instead of the selection. module is the top\n");
+		log("        design of the export.\n");
+		log("\n");
+		log("    -j <N>\n");
+		log("        build the design implementations on N threads (0: one per core).\n");
+		log("        The output does not depend on N.\n");
+		log("\n");
+		log("    -split <N>\n");
+		log("        write the design implementations N at a time in separate\n");
+		log("        db_implementation.<chunk>.snl files, listed in db_implementation.idx.\n");
+		log("        Designs are freed once copied in their chunk and chunks once\n");
+		log("        written. The next chunk is built while the previous one is\n");
+		log("        written, so memory holds about two chunks, and their serialized\n");
+		log("        copy with -compress, instead of the whole design.\n");
+		log("\n");
+		log("    -tie-xz <0|1>\n");
+		log("        connect the x and z constant bits to the logic-0 or logic-1 net\n");
+		log("        of their design. By default they are left unconnected, while 0\n");
+		log("        and 1 bits, of cell and module connections, are connected to one\n");
+		log("        unnamed ASSIGN0 and one ASSIGN1 net per design.\n");
+		log("\n");
+		log("    -order <bfs|rcm|name>\n");
+		log("        number the instances and nets of each design for locality\n");
+		log("        instead of in RTLIL order: bfs numbers instances in breadth first\n");
+		log("        order from the design terms, rcm in reverse Cuthill-McKee order,\n");
+		log("        both over the net bits they share, nets with more than 64\n");
+		log("        instances such as clocks being ignored, and name by name, which\n");
+		log("        groups the instances of a flattened hierarchy. Nets follow\n");
+		log("        their first instance (name: by name), and the components of\n");
+		log("        each net are listed by instance ID.\n");
+		log("\n");
+		log("    -index\n");
+		log("        write each design implementation as its own message in the\n");
+		log("        implementation files and list, in db_designs.idx, the library\n");
+		log("        and design IDs, file, byte offset and length, instances and nets\n");
+		log("        of every design, so that a reader decodes a single design\n");
+		log("        (read_naja-if -design). The layout is recorded in snl.mf.\n");
+		log("\n");
+		log("    -stats\n");
+		log("        write export statistics to snl_stats.json next to snl.mf: wall\n");
+		log("        time per phase, peak RSS, bytes per file and object counts.\n");
+		log("        The path of the file is set in the write_naja-if.stats\n");
+		log("        scratchpad variable.\n");
+		log("\n");
+		log("    -dedup\n");
+		log("        export structurally identical user modules, such as equivalent\n");
+		log("        $paramod modules, as a single design named after one of them,\n");
+		log("        the top module if it is one of them. Instances of the other\n");
+		log("        modules reference this design.\n");
+		log("\n");
+		log("    -unpacked\n");
+		log("        write unpacked capnp messages (segment table and word aligned\n");
+		log("        segments) that readers can mmap and use without decoding.\n");
+		log("        The encoding is recorded in snl.mf.\n");
+		log("\n");
+		log("    -compress zstd\n");
+		log("        compress the .snl files in independent zstd frames, compressed\n");
+		log("        on -j threads and decompressible in parallel. The frame\n");
+		log("        format is recorded in snl.mf.\n");
+		log("\n");
+		log("    -frame-size <KiB>\n");
+		log("        uncompressed size of a compressed frame (default: 4096).\n");
+		log("\n");
+		log("    -write-primitives-library <file>\n");
+		log("        write all the blackbox modules of the design, for instance a\n");
+		log("        cell library read with read_verilog -lib or read_liberty -lib,\n");
+		log("        to a primitives library file, then stop: the design itself\n");
+		log("        is not written.\n");
+		log("\n");
+		log("    -primitives-library <file>\n");
+		log("        use the primitives of a library written with\n");
+		log("        -write-primitives-library. They keep their library IDs and\n");
+		log("        are copied as is to db_interface.snl: only the primitives\n");
+		log("        the library does not define are collected and dumped.\n");
+		log("\n");
+		log("    -stream <target>\n");
+		log("        write the files to a single stream instead of the snl directory,\n");
+		log("        for a consumer such as read_naja-if -stream loading them while\n");
+		log("        the export runs. target is fd:<N> for an inherited file\n");
+		log("        descriptor, or the path of a listening Unix domain socket, of a\n");
+		log("        FIFO or of a file. The manifest comes first, then the interface\n");
+		log("        and the implementation files, each as a length prefixed item\n");
+		log("        (see snl_writer.h). Messages are unpacked; -compress and -index\n");
+		log("        are not supported. Statistics go to snl_stats.json.\n");
+		log("\n");
+		log("    -trace <categories>\n");
+		log("        trace the export on stderr, for a comma separated list of\n");
+		log("        categories among modules, terms, parameters, nets, instances,\n");
+		log("        components or all. Designs loaded from the cache are not traced.\n");
+		log("        Off by default, disabled trace points cost nothing.\n");
+		log("\n");
+		log("    -trace-filter <pattern>\n");
+		log("        only trace the objects whose name or module name matches the\n");
+		log("        pattern, for instance -trace-filter \"*clk*\".\n");
+		log("\n");
+		log("    -cache <dir>\n");
+		log("        reuse the interface and implementation of the designs whose\n");
+		log("        contents did not change since a previous export with the same\n");
+		log("        cache directory. Entries are keyed by a hash of the module\n");
+		log("        ports, cells, parameters and connections; only changed designs\n");
+		log("        are rebuilt, and adding or removing modules does not change the\n");
+		log("        keys of the others. The directory is never pruned and can be\n");
+		log("        removed at any time.\n");
 		log("\n");
 	}
 
 } SNLBackend;
 
+//write_snl, the name of the backend before naja-if, kept for the
+//existing scripts
+struct SNLAliasBackend: public SNLBackend {
+  SNLAliasBackend() : SNLBackend("snl", "alias of write_naja-if") {}
+	void help() override
+	{
+		log("\n");
+		log("    write_snl [options]\n");
+		log("\n");
+		log("Alias of write_naja-if, see help write_naja-if.\n");
+		log("\n");
+	}
+} SNLAliasBackend;
+
 PRIVATE_NAMESPACE_END
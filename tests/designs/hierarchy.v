@@ -0,0 +1,23 @@
+(* blackbox *)
+module AND2(input A, input B, output Y);
+endmodule
+
+(* blackbox *)
+module DFF(input C, input D, output Q);
+endmodule
+
+module half(input clk, input [1:0] a, output q);
+  wire y;
+  AND2 g (.A(a[0]), .B(a[1]), .Y(y));
+  DFF r (.C(clk), .D(y), .Q(q));
+endmodule
+
+module top(input clk, input [3:0] a, output [1:0] q, output t, output [1:0] k);
+  wire low = 1'b0;
+  half h0 (.clk(clk), .a(a[1:0]), .q(q[0]));
+  half h1 (.clk(clk), .a(a[3:2]), .q(q[1]));
+  // constant bits: of a cell connection, of an aliased wire, of ports
+  AND2 tie (.A(a[0]), .B(1'b1), .Y(t));
+  DFF hold (.C(clk), .D(low), .Q());
+  assign k = 2'b01;
+endmodule
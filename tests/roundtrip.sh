@@ -0,0 +1,96 @@
+#!/bin/sh
+# Writes a design with write_naja-if and reads it back with read_naja-if.
+# The read back of the <mode> export must give the same statistics as the
+# read back of a plain export.
+#
+# Usage: roundtrip.sh <yosys> <plugin> <design.v> <mode>
+#   stream:    -stream to a file
+#   fifo:      -stream through a FIFO, writer and reader running together
+#   compress:  -compress
+#   index:     -index, read back in full
+#   design:    -index, read back with -design half, compared with
+#              read_naja-if -design half of the plain export
+#   constants: the 0 and 1 bits read back as constants
+#   order:     -order bfs, rcm and name, each exported twice, on 1 and 4
+#              threads, to byte identical files
+set -e
+
+yosys=$1
+plugin=$2
+design=$3
+mode=$4
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+
+run() {
+  "$yosys" -q -m "$plugin" -p "$1"
+}
+
+load="read_verilog $design; hierarchy -top top"
+check="select -assert-count 2 t:half; select -assert-count 3 t:AND2; select -assert-count 3 t:DFF"
+# top is left as a blackbox: only the cells of half are imported
+designCheck="select -assert-count 0 t:half; select -assert-count 1 t:AND2; select -assert-count 1 t:DFF"
+
+run "$load; write_naja-if"
+if [ "$mode" = design ]; then
+  run "read_naja-if -design half; $designCheck; tee -q -o reference.stat stat"
+else
+  run "read_naja-if; $check; tee -q -o reference.stat stat"
+fi
+
+case $mode in
+  stream)
+    run "$load; write_naja-if -stream snl.stream"
+    run "read_naja-if -stream snl.stream; $check; tee -q -o result.stat stat"
+    ;;
+  fifo)
+    mkfifo snl.fifo
+    run "$load; write_naja-if -stream snl.fifo" &
+    writer=$!
+    run "read_naja-if -stream snl.fifo; $check; tee -q -o result.stat stat"
+    wait $writer
+    ;;
+  compress)
+    rm -rf snl
+    run "$load; write_naja-if -compress"
+    grep -q "zstd" snl/snl.mf
+    run "read_naja-if; $check; tee -q -o result.stat stat"
+    ;;
+  index)
+    rm -rf snl
+    run "$load; write_naja-if -index"
+    test -f snl/db_designs.idx
+    run "read_naja-if; $check; tee -q -o result.stat stat"
+    ;;
+  design)
+    rm -rf snl
+    run "$load; write_naja-if -index"
+    run "read_naja-if -design half; $designCheck; tee -q -o result.stat stat"
+    ;;
+  constants)
+    run "read_naja-if; $check; sat -ignore_unknown_cells -verify -prove k 2'b01 top; write_verilog -noattr result.v; tee -q -o result.stat stat"
+    grep -q "\.B(1'h1)" result.v
+    grep -q "\.D(1'h0)" result.v
+    ;;
+  order)
+    for order in bfs rcm name; do
+      rm -rf snl first
+      run "$load; write_naja-if -order $order -j 1"
+      mv snl first
+      run "$load; write_naja-if -order $order -j 4"
+      for file in first/*; do
+        cmp "$file" "snl/$(basename "$file")"
+      done
+      run "read_naja-if; $check; tee -q -o result.stat stat"
+      diff reference.stat result.stat
+    done
+    ;;
+  *)
+    echo "unknown mode $mode" >&2
+    exit 2
+    ;;
+esac
+
+diff reference.stat result.stat